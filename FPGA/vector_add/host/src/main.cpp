@@ -192,9 +192,12 @@ unsigned num_devices = 0;
     status = clSetKernelArg(kernel, argi++, sizeof(cl_mem), &output_buf);
     checkError(status, "Failed to set argument 3");
 
+    // the work-group size is compiled into the kernel with reqd_work_group_size,
+    // so it is passed as is instead of being tuned like on the gpu
     const size_t global_work_size = N;
+    const size_t local_work_size = 256;
     status = clEnqueueNDRangeKernel(queue, kernel, 1, NULL,
-        &global_work_size, NULL, 2, write_event, &kernel_event);
+        &global_work_size, &local_work_size, 2, write_event, &kernel_event);
     checkError(status, "Failed to launch kernel");
     // Read the result. This the final operation.
     status = clEnqueueReadBuffer(queue, output_buf, CL_TRUE,
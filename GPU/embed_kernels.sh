@@ -0,0 +1,75 @@
+#!/bin/sh
+# embed_kernels.sh OUT FILE.cl... [-b FILE.clbin...]
+#
+# writes OUT, a header with the source of every FILE.cl as constant data for
+# embedded_kernels.h, so a host needs no .cl files at runtime. every FILE.clbin
+# after -b, what the offline compiler made of FILE.cl without any options, is
+# embedded next to its source, see CLCC in the Makefiles
+
+out=$1
+shift
+sources=
+binaries=
+while [ $# -gt 0 ] && [ "$1" != "-b" ]; do
+    sources="$sources $1"
+    shift
+done
+if [ "$1" = "-b" ]; then
+    shift
+    binaries="$*"
+fi
+
+# the binary embedded for source $1, empty when there is none
+binary() {
+    for b in $binaries; do
+        if [ "$b" = "${1%.cl}.clbin" ]; then
+            echo "$b"
+        fi
+    done
+}
+
+# the bytes of a file as a C initializer, with a terminating zero
+bytes() {
+    od -An -v -tx1 "$1" | sed -e 's/\([0-9a-f][0-9a-f]\)/0x\1,/g' -e 's/^ */    /'
+    echo "    0x00"
+}
+
+{
+    echo "// generated by embed_kernels.sh, do not edit"
+    echo "#ifndef KERNELS_H"
+    echo "#define KERNELS_H"
+    echo
+    echo "#include \"embedded_kernels.h\""
+    echo
+
+    n=0
+    for f in $sources; do
+        echo "// $f"
+        echo "static const unsigned char kernel_${n}_source[] = {"
+        bytes "$f"
+        echo "};"
+        bin=$(binary "$f")
+        if [ -n "$bin" ]; then
+            echo "static const unsigned char kernel_${n}_binary[] = {"
+            bytes "$bin"
+            echo "};"
+        fi
+        echo
+        n=$((n + 1))
+    done
+
+    echo "const embedded_kernel embedded_kernels[] = {"
+    n=0
+    for f in $sources; do
+        if [ -n "$(binary "$f")" ]; then
+            echo "    { \"$(basename "$f")\", kernel_${n}_source, kernel_${n}_binary, sizeof(kernel_${n}_binary) - 1 },"
+        else
+            echo "    { \"$(basename "$f")\", kernel_${n}_source, NULL, 0 },"
+        fi
+        n=$((n + 1))
+    done
+    echo "};"
+    echo "const int num_embedded_kernels = $n;"
+    echo
+    echo "#endif // KERNELS_H"
+} > "$out.tmp" && mv "$out.tmp" "$out"
@@ -0,0 +1,65 @@
+#ifndef EMBEDDED_KERNELS_H
+#define EMBEDDED_KERNELS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "program_cache.h"
+
+// kernels compiled into the host, so it starts without reading or printing
+// any .cl file and runs from any directory. make turns the .cl files of a host
+// into its kernels.h with embed_kernels.sh, which defines the table below.
+// with an offline compiler (CLCC in the Makefile) the table also has a device
+// binary for the files the host builds without options, BIN_KERNELS in the
+// Makefile, loaded like the .aocx of the FPGA host. builds with options always
+// compile the source, through the program cache
+
+struct embedded_kernel {
+    const char *name;               // file name of the .cl, e.g. "average.cl"
+    const unsigned char *source;    // zero terminated
+    const unsigned char *binary;    // NULL when there was no offline compiler
+    size_t binary_size;
+};
+
+extern const embedded_kernel embedded_kernels[];
+extern const int num_embedded_kernels;
+
+// the kernel built into the host from file name, NULL when there is none
+const embedded_kernel *embedded_kernel_find(const char *name)
+{
+    for (int i = 0; i < num_embedded_kernels; i++) {
+        if (strcmp(embedded_kernels[i].name, name) == 0)
+            return &embedded_kernels[i];
+    }
+    return NULL;
+}
+
+// creates and builds *program from the embedded kernel name. the offline
+// binary is only used without options, it was compiled without any, and a
+// binary the device rejects falls back to the source. sources go through the
+// program cache. returns the build status like program_cache_build
+cl_int build_embedded_program(cl_context context, cl_device_id device, const char *name, const char *options, cl_program *program)
+{
+    const embedded_kernel *k = embedded_kernel_find(name);
+    if (k == NULL) {
+        printf("no kernel %s built into the host\n", name);
+        *program = NULL;
+        return CL_INVALID_VALUE;
+    }
+
+    if (k->binary != NULL && (options == NULL || options[0] == '\0')) {
+        cl_int status, binary_status;
+        const size_t size = k->binary_size;
+        const unsigned char *binaries[1] = { k->binary };
+        *program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &binary_status, &status);
+        if (status == CL_SUCCESS && binary_status == CL_SUCCESS && clBuildProgram(*program, 1, &device, NULL, NULL, NULL) == CL_SUCCESS)
+            return CL_SUCCESS;
+        if (*program != NULL)
+            clReleaseProgram(*program);
+        printf("offline binary of %s doesn't load on this device, building it from source\n", name);
+    }
+    return program_cache_build(context, device, (const char *)k->source, options, program);
+}
+
+#endif // EMBEDDED_KERNELS_H
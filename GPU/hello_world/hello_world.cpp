@@ -4,6 +4,9 @@
 #include <fstream>
 #include <CL/cl.h>
 #include <CL/cl_ext.h>
+
+#include "kernels.h"
+
 #define STRING_BUFFER_LEN 1024
 using namespace std;
 
@@ -24,35 +27,6 @@ void print_clbuild_errors(cl_program program,cl_device_id device)
 		cout<<"--- Build log ---\n "<<buffer<<endl;
 		exit(1);
 	}
-unsigned char ** read_file(const char *name) {
-  size_t size;
-  unsigned char **output=(unsigned char **)malloc(sizeof(unsigned char *));
-  FILE* fp = fopen(name, "rb");
-  if (!fp) {
-    printf("no such file:%s",name);
-    exit(-1);
-  }
-
-  fseek(fp, 0, SEEK_END);
-  size = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-
-  *output = (unsigned char *)malloc(size);
-  if (!*output) {
-    fclose(fp);
-    printf("mem allocate failure:%s",name);
-    exit(-1);
-  }
-
-  if(!fread(*output, size, 1, fp)) printf("failed to read file\n");
-  fclose(fp);
-  #ifdef DEBUG
-  printf("%s",*output);
-  #endif
-  return output;
-}
-
-
 void callback(const char *buffer, size_t length, size_t final, void *user_data)
 {
      fwrite(buffer, 1, length, stdout);
@@ -89,15 +63,13 @@ int main()
      clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
      context = clCreateContext(context_properties, 1, &device, NULL, NULL, NULL);
      queue = clCreateCommandQueue(context, device, 0, NULL);
-     unsigned char **opencl_program=read_file("hello_world.cl");
-     program = clCreateProgramWithSource(context, 1, (const char **)opencl_program, NULL, NULL);
      // program = clCreateProgramWithSource(context, 1, &opencl, NULL, NULL);
+     int success=build_embedded_program(context, device, "hello_world.cl", NULL, &program);
      if (program == NULL)
 	{
          printf("Program creation failed\n");
          return 1;
 	}	
-     int success=clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
 	 if(success!=CL_SUCCESS) print_clbuild_errors(program,device);
      kernel = clCreateKernel(program, "hello", NULL);
      clEnqueueTask(queue, kernel, 0, NULL, NULL);
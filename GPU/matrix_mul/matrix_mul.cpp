@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream> // for standard I/O
 #include <math.h>
 #include <time.h>
@@ -8,6 +9,8 @@
 #include <chrono>
 
 #include "helpers.h"
+#include "tune.h"
+#include "kernels.h"
 
 #define STRING_BUFFER_LEN 1024
 
@@ -64,8 +67,10 @@ void matrix_mul_cpu(float *C, float *A, float *B, int N) {
 }
 
 
-int main()
+int main(int argc, char **argv)
 {
+    // --tune times every local size first and saves the fastest
+    const bool tune_mode = argc > 1 && strcmp(argv[1], "--tune") == 0;
     char char_buffer[STRING_BUFFER_LEN];
     cl_platform_id platform;
     cl_device_id device;
@@ -110,14 +115,12 @@ int main()
     const size_t ws = N*N;
     const size_t *global_work_size = &ws;
 #endif // USE_2D_KERNEL
-    unsigned char **opencl_program = read_file(program_file_name);
-    program = clCreateProgramWithSource(context, 1, (const char **)opencl_program, NULL, NULL);
+    int success = build_embedded_program(context, device, program_file_name, NULL, &program);
     if (program == NULL)
     {
         printf("Program creation failed\n");
         return 1;
     }	
-    int success = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
     if(success != CL_SUCCESS) print_clbuild_errors(program,device);
     kernel = clCreateKernel(program, "matrix_mul", NULL);
     printf("Kernel build successful\n");
@@ -202,10 +205,20 @@ int main()
 
 
 
+    // tuned local size for this device and N, the runtime's choice without
+    char problem[STRING_BUFFER_LEN];
+    snprintf(problem, STRING_BUFFER_LEN, "N=%ld %dd", N, KERNEL_DIM);
+    tune_table tune;
+    tune_init(&tune, TUNE_FILE, device, problem);
+    if (tune_mode) {
+        tune_kernel(&tune, "matrix_mul", 0, device, queue, kernel, KERNEL_DIM, global_work_size[0], KERNEL_DIM > 1 ? global_work_size[1] : 1);
+        tune_save(&tune);
+    }
+
     // first run
     start = chrono::high_resolution_clock::now();
 
-    status = clEnqueueNDRangeKernel(queue, kernel, KERNEL_DIM, NULL, global_work_size, NULL, 0, NULL, &kernel_event);
+    status = clEnqueueNDRangeKernel(queue, kernel, KERNEL_DIM, NULL, global_work_size, tune_local(&tune, "matrix_mul"), 0, NULL, &kernel_event);
     checkError(status, "Failed to launch kernel");
 
     status = clWaitForEvents(1, &kernel_event);
@@ -0,0 +1,166 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <CL/cl.h>
+
+// compiled programs kept on disk, so a restarted host loads the device binary
+// instead of running the compiler again. a binary is stored under a hash of
+// everything that goes into it: the source text, the build options, the device
+// and the driver version, so any change to one of them is a miss and gets a
+// fresh source build. a binary the driver rejects is rebuilt from source and
+// replaced. the directory is $CL_PROGRAM_CACHE, or PROGRAM_CACHE_DIR in the
+// working directory, an empty $CL_PROGRAM_CACHE turns the cache off
+
+#define PROGRAM_CACHE_DIR "clcache"
+#define PROGRAM_CACHE_MAGIC 0x42434c43u    // "CLCB"
+
+// what goes in front of the binary in its file, so a truncated or foreign file
+// is a miss instead of a broken program
+struct program_cache_header {
+    unsigned int magic;
+    unsigned long long key;
+    unsigned long long size;
+};
+
+static unsigned long long program_cache_hash(unsigned long long h, const char *s)
+{
+    // fnv-1a, the terminating zero keeps "ab" + "c" apart from "a" + "bc"
+    do {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ull;
+    } while (*s++ != '\0');
+    return h;
+}
+
+static unsigned long long program_cache_key(cl_device_id device, const char *source, const char *options)
+{
+    char info[256];
+    unsigned long long h = 0xcbf29ce484222325ull;
+    h = program_cache_hash(h, source);
+    h = program_cache_hash(h, options != NULL ? options : "");
+    info[0] = '\0';
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(info), info, NULL);
+    h = program_cache_hash(h, info);
+    info[0] = '\0';
+    clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(info), info, NULL);
+    h = program_cache_hash(h, info);
+    return h;
+}
+
+// the cache file for key, false when the cache is off
+static bool program_cache_path(unsigned long long key, char *path, size_t len)
+{
+    const char *dir = getenv("CL_PROGRAM_CACHE");
+    if (dir == NULL)
+        dir = PROGRAM_CACHE_DIR;
+    if (dir[0] == '\0')
+        return false;
+    snprintf(path, len, "%s/%016llx.bin", dir, key);
+    return true;
+}
+
+// the program in the cache file at path, built for device, or NULL on a miss
+static cl_program program_cache_load(cl_context context, cl_device_id device, const char *path, unsigned long long key)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    program_cache_header header;
+    unsigned char *binary = NULL;
+    bool ok = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == PROGRAM_CACHE_MAGIC && header.key == key && header.size > 0;
+    if (ok) {
+        binary = (unsigned char *)malloc(header.size);
+        ok = binary != NULL && fread(binary, header.size, 1, fp) == 1;
+    }
+    fclose(fp);
+    if (!ok) {
+        free(binary);
+        return NULL;
+    }
+
+    cl_int status, binary_status;
+    const size_t size = header.size;
+    const unsigned char *binaries[1] = { binary };
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, binaries, &binary_status, &status);
+    free(binary);
+    if (status != CL_SUCCESS || binary_status != CL_SUCCESS) {
+        if (program != NULL)
+            clReleaseProgram(program);
+        return NULL;
+    }
+    if (clBuildProgram(program, 1, &device, NULL, NULL, NULL) != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+// writes the binary of a built program to path, through a temporary file so a
+// host starting at the same time never reads half of it
+static void program_cache_store(cl_program program, const char *path, unsigned long long key)
+{
+    size_t size = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0)
+        return;
+    unsigned char *binary = (unsigned char *)malloc(size);
+    if (binary == NULL)
+        return;
+    unsigned char *binaries[1] = { binary };
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) != CL_SUCCESS) {
+        free(binary);
+        return;
+    }
+
+    char dir[1024], tmp[1100];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    program_cache_header header = { PROGRAM_CACHE_MAGIC, key, size };
+    FILE *fp = fopen(tmp, "wb");
+    bool ok = fp != NULL && fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(binary, size, 1, fp) == 1;
+    if (fp != NULL)
+        ok = fclose(fp) == 0 && ok;
+    if (ok)
+        ok = rename(tmp, path) == 0;
+    if (!ok) {
+        printf("can't write program cache file %s\n", path);
+        remove(tmp);
+    }
+    free(binary);
+}
+
+// creates *program from the cached binary for source and options, or builds it
+// from source and caches the result. returns the clBuildProgram status of the
+// source build, CL_SUCCESS on a hit, so the caller can print the build log
+cl_int program_cache_build(cl_context context, cl_device_id device, const char *source, const char *options, cl_program *program)
+{
+    char path[1024];
+    const unsigned long long key = program_cache_key(device, source, options);
+    const bool cached = program_cache_path(key, path, sizeof(path));
+
+    if (cached) {
+        *program = program_cache_load(context, device, path, key);
+        if (*program != NULL)
+            return CL_SUCCESS;
+    }
+
+    *program = clCreateProgramWithSource(context, 1, &source, NULL, NULL);
+    if (*program == NULL)
+        return CL_INVALID_PROGRAM;
+    cl_int status = clBuildProgram(*program, 1, &device, options, NULL, NULL);
+    if (status == CL_SUCCESS && cached)
+        program_cache_store(*program, path, key);
+    return status;
+}
+
+#endif // PROGRAM_CACHE_H
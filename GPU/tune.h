@@ -0,0 +1,268 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <CL/cl.h>
+
+// launch parameters picked by benchmarking on the device, shared by the hosts
+// under GPU/. every host loads the results for its device and problem size at
+// startup and passes them to clEnqueueNDRangeKernel, kernels without a result
+// keep a NULL local size and their default vector width. --tune in a host
+// measures its kernels and writes the winners back to the file
+
+#define TUNE_FILE "tune.txt"    // in the working directory
+#define TUNE_MAX 32             // results per device and problem
+#define TUNE_MAX_CANDIDATES 64  // local sizes tried per kernel
+#define TUNE_RUNS 10            // timed launches per candidate, after one warm-up
+#define TUNE_NAME_LEN 128
+
+struct tune_result {
+    char kernel[TUNE_NAME_LEN];
+    size_t local[3];    // local[0] == 0 leaves the local size to the runtime
+    int vec;            // vector width the kernel was built with, 0 when it has none
+};
+
+// the results for one device, driver and problem. the file has one tab
+// separated line per result:
+//   device  driver  problem  kernel  local_x local_y local_z  vec
+// and keeps the lines of other devices and problems when it is written
+struct tune_table {
+    const char *path;
+    char device[TUNE_NAME_LEN];
+    char driver[TUNE_NAME_LEN];
+    char problem[TUNE_NAME_LEN];
+    int n;
+    tune_result results[TUNE_MAX];
+};
+
+// the launch being tuned, with the args already set
+typedef cl_int (*tune_launch)(void *arg);
+
+static tune_result *tune_find(const tune_table *t, const char *kernel)
+{
+    for (int i = 0; i < t->n; i++) {
+        if (strcmp(t->results[i].kernel, kernel) == 0)
+            return (tune_result *)&t->results[i];
+    }
+    return NULL;
+}
+
+// splits line at the tabs, returns the number of fields
+static int tune_split(char *line, char **fields, int max_fields)
+{
+    int n = 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    for (char *p = line; n < max_fields; n++) {
+        fields[n] = p;
+        p = strchr(p, '\t');
+        if (p == NULL)
+            return n + 1;
+        *p++ = '\0';
+    }
+    return n;
+}
+
+// true when line is a result for the device, driver and problem of t
+static bool tune_matches(const tune_table *t, char **fields, int n)
+{
+    return n == 6 && strcmp(fields[0], t->device) == 0 && strcmp(fields[1], t->driver) == 0 && strcmp(fields[2], t->problem) == 0;
+}
+
+// loads what path has for device and problem, a missing file is an empty table
+void tune_init(tune_table *t, const char *path, cl_device_id device, const char *problem)
+{
+    t->path = path;
+    t->n = 0;
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(t->device), t->device, NULL);
+    clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(t->driver), t->driver, NULL);
+    snprintf(t->problem, sizeof(t->problem), "%s", problem);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return;
+    char line[1024];
+    char *fields[6];
+    while (fgets(line, sizeof(line), fp) != NULL && t->n < TUNE_MAX) {
+        if (line[0] == '#' || !tune_matches(t, fields, tune_split(line, fields, 6)))
+            continue;
+        tune_result *r = &t->results[t->n];
+        if (sscanf(fields[4], "%zu %zu %zu", &r->local[0], &r->local[1], &r->local[2]) != 3)
+            continue;
+        snprintf(r->kernel, sizeof(r->kernel), "%s", fields[3]);
+        r->vec = atoi(fields[5]);
+        t->n++;
+    }
+    fclose(fp);
+    if (t->n > 0)
+        printf("%d tuned kernels for %s, %s from %s\n", t->n, t->device, t->problem, path);
+}
+
+// the tuned local size of kernel, NULL to let the runtime pick one
+const size_t *tune_local(const tune_table *t, const char *kernel)
+{
+    const tune_result *r = t == NULL ? NULL : tune_find(t, kernel);
+    return r != NULL && r->local[0] > 0 ? r->local : NULL;
+}
+
+// the tuned vector width of kernel, or def
+int tune_vec(const tune_table *t, const char *kernel, int def)
+{
+    const tune_result *r = t == NULL ? NULL : tune_find(t, kernel);
+    return r != NULL && r->vec > 0 ? r->vec : def;
+}
+
+// local NULL for the runtime's choice
+void tune_set(tune_table *t, const char *kernel, const size_t *local, int vec)
+{
+    tune_result *r = tune_find(t, kernel);
+    if (r == NULL) {
+        if (t->n == TUNE_MAX) {
+            printf("too many tuned kernels, %s is left out\n", kernel);
+            return;
+        }
+        r = &t->results[t->n++];
+        snprintf(r->kernel, sizeof(r->kernel), "%s", kernel);
+    }
+    for (int d = 0; d < 3; d++)
+        r->local[d] = local != NULL ? local[d] : 0;
+    r->vec = vec;
+}
+
+// rewrites the file with the results of t in place of the old ones for the same
+// device, driver and problem
+bool tune_save(const tune_table *t)
+{
+    // the lines of other devices and problems are kept as they are
+    char *kept = NULL;
+    size_t kept_len = 0;
+    FILE *fp = fopen(t->path, "r");
+    if (fp != NULL) {
+        char line[1024], copy[1024];
+        char *fields[6];
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            snprintf(copy, sizeof(copy), "%s", line);
+            if (line[0] != '#' && tune_matches(t, fields, tune_split(copy, fields, 6)))
+                continue;
+            const size_t len = strlen(line);
+            kept = (char *)realloc(kept, kept_len + len + 1);
+            memcpy(kept + kept_len, line, len + 1);
+            kept_len += len;
+        }
+        fclose(fp);
+    }
+
+    fp = fopen(t->path, "w");
+    if (fp == NULL) {
+        printf("can't write tuning results to %s\n", t->path);
+        free(kept);
+        return false;
+    }
+    if (kept != NULL)
+        fputs(kept, fp);
+    for (int i = 0; i < t->n; i++) {
+        const tune_result *r = &t->results[i];
+        fprintf(fp, "%s\t%s\t%s\t%s\t%zu %zu %zu\t%d\n", t->device, t->driver, t->problem, r->kernel,
+                r->local[0], r->local[1], r->local[2], r->vec);
+    }
+    fclose(fp);
+    free(kept);
+    printf("tuning results for %s, %s written to %s\n", t->device, t->problem, t->path);
+    return true;
+}
+
+// ms per launch, averaged over TUNE_RUNS after a warm-up, negative when the
+// launch fails, e.g. with a local size the kernel can't run
+double tune_time(cl_command_queue queue, tune_launch launch, void *arg)
+{
+    if (launch(arg) != CL_SUCCESS || clFinish(queue) != CL_SUCCESS)
+        return -1;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < TUNE_RUNS; i++) {
+        if (launch(arg) != CL_SUCCESS)
+            return -1;
+    }
+    if (clFinish(queue) != CL_SUCCESS)
+        return -1;
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0 / TUNE_RUNS;
+}
+
+// powers of two that divide global in every dimension and fit the device's
+// work-group size. opencl 1.x needs the global size to be a multiple of the
+// local size, so these are the only ones a launch can use
+static int tune_candidates(cl_device_id device, cl_uint dims, const size_t *global, size_t (*local)[3])
+{
+    size_t max_wg = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_wg), &max_wg, NULL);
+    int n = 0;
+    const size_t max_y = dims > 1 ? 64 : 1;
+    for (size_t x = dims > 1 ? 2 : 8; x <= max_wg && x <= 1024; x *= 2) {
+        for (size_t y = 1; y <= max_y && x * y <= max_wg; y *= 2) {
+            if (global[0] % x != 0 || (dims > 1 && global[1] % y != 0) || x * y < 8 || n == TUNE_MAX_CANDIDATES)
+                continue;
+            local[n][0] = x;
+            local[n][1] = y;
+            local[n][2] = 1;
+            n++;
+        }
+    }
+    return n;
+}
+
+// times launch with every candidate local size for kernel and the runtime's
+// choice, leaves the fastest in t with vector width vec and returns its time
+double tune_local_size(tune_table *t, const char *kernel, int vec, cl_device_id device, cl_command_queue queue,
+                       cl_uint dims, const size_t *global, tune_launch launch, void *arg)
+{
+    size_t local[TUNE_MAX_CANDIDATES][3];
+    const int n = tune_candidates(device, dims, global, local);
+
+    tune_set(t, kernel, NULL, vec);
+    double best_ms = tune_time(queue, launch, arg);
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        tune_set(t, kernel, local[i], vec);
+        const double ms = tune_time(queue, launch, arg);
+        if (ms >= 0 && (best_ms < 0 || ms < best_ms)) {
+            best_ms = ms;
+            best = i;
+        }
+    }
+
+    tune_set(t, kernel, best >= 0 ? local[best] : NULL, vec);
+    if (best >= 0)
+        printf("tuned %-20s vec %2d  local %zux%zu  %.3f ms\n", kernel, vec, local[best][0], local[best][1], best_ms);
+    else
+        printf("tuned %-20s vec %2d  local runtime  %.3f ms\n", kernel, vec, best_ms);
+    return best_ms;
+}
+
+// one launch of a kernel whose args are all set, with the tuned local size of name
+struct tune_kernel_launch {
+    cl_command_queue queue;
+    cl_kernel kernel;
+    const char *name;
+    const tune_table *tune;
+    cl_uint dims;
+    size_t global[3];
+};
+
+static cl_int tune_launch_kernel(void *arg)
+{
+    const tune_kernel_launch *l = (const tune_kernel_launch *)arg;
+    return clEnqueueNDRangeKernel(l->queue, l->kernel, l->dims, NULL, l->global, tune_local(l->tune, l->name), 0, NULL, NULL);
+}
+
+// tune_local_size for a single kernel with its args set, over a global size
+// of global_x, or global_x x global_y
+double tune_kernel(tune_table *t, const char *name, int vec, cl_device_id device, cl_command_queue queue,
+                   cl_kernel kernel, cl_uint dims, size_t global_x, size_t global_y)
+{
+    tune_kernel_launch l = { queue, kernel, name, t, dims, { global_x, global_y, 1 } };
+    return tune_local_size(t, name, vec, device, queue, dims, l.global, tune_launch_kernel, &l);
+}
+
+#endif // TUNE_H
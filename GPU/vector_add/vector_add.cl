@@ -1,6 +1,19 @@
-__kernel void vector_add(__global const float4 *x, 
-                         __global const float4 *y, 
-                         __global float4 *restrict z)
+#ifndef VEC
+#define VEC 4
+#endif
+
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+#if VEC == 1
+#define FLOATN float
+#else
+#define FLOATN CAT(float, VEC)
+#endif
+
+// VEC floats per work-item, --tune picks it for the device
+__kernel void vector_add(__global const FLOATN *x, 
+                         __global const FLOATN *y, 
+                         __global FLOATN *restrict z)
 {
     int id = get_global_id(0);
     z[id] = x[id] + y[id];
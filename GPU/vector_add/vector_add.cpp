@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream> // for standard I/O
 #include <math.h>
 #include <time.h>
@@ -8,6 +9,9 @@
 
 #include <chrono>
 
+#include "tune.h"
+#include "kernels.h"
+
 #define STRING_BUFFER_LEN 1024
 #define USE_MAP_BUFFER 1
 
@@ -25,37 +29,6 @@ void print_clbuild_errors(cl_program program,cl_device_id device)
     exit(1);
 }
 
-unsigned char **read_file(const char *name) {
-    size_t size;
-    unsigned char **output=(unsigned char **)malloc(sizeof(unsigned char *));
-    FILE* fp = fopen(name, "rb");
-    if (!fp) {
-        printf("no such file:%s",name);
-        exit(-1);
-    }
-
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    *output = (unsigned char *)malloc(size);
-    unsigned char **outputstr=(unsigned char **)malloc(sizeof(unsigned char *));
-    *outputstr= (unsigned char *)malloc(size);
-    if (!*output) {
-        fclose(fp);
-        printf("mem allocate failure:%s",name);
-        exit(-1);
-    }
-
-    if(!fread(*output, size, 1, fp)) printf("failed to read file\n");
-    fclose(fp);
-    printf("file size %d\n",size);
-    printf("-------------------------------------------\n");
-    snprintf((char *)*outputstr,size,"%s\n",*output);
-    printf("%s\n",*outputstr);
-    printf("-------------------------------------------\n");
-    return outputstr;
-}
 void callback(const char *buffer, size_t length, size_t final, void *user_data)
 {
     fwrite(buffer, 1, length, stdout);
@@ -67,13 +40,40 @@ void checkError(int status, const char *msg) {
         printf("%s\n",msg);
 }
 
+// builds vector_add.cl for vec floats per work-item
+cl_kernel build_vector_add(cl_context context, cl_device_id device, int vec, cl_program *program)
+{
+    char build_options[32];
+    snprintf(build_options, sizeof(build_options), "-DVEC=%d", vec);
+    int success = build_embedded_program(context, device, "vector_add.cl", build_options, program);
+    if (*program == NULL)
+    {
+        printf("Program creation failed\n");
+        exit(1);
+    }
+    if(success != CL_SUCCESS) print_clbuild_errors(*program,device);
+    return clCreateKernel(*program, "vector_add", NULL);
+}
+
+void set_vector_add_args(cl_kernel kernel, cl_mem a, cl_mem b, cl_mem out)
+{
+    int status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+    checkError(status, "Failed to set argument 1");
+    status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &b);
+    checkError(status, "Failed to set argument 2");
+    status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &out);
+    checkError(status, "Failed to set argument 3");
+}
+
 // Randomly generate a floating-point number between -10 and 10.
 float rand_float() {
     return float(rand()) / float(RAND_MAX) * 20.0f - 10.0f;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    // --tune times every vector width and local size first and saves the fastest
+    const bool tune_mode = argc > 1 && strcmp(argv[1], "--tune") == 0;
     char char_buffer[STRING_BUFFER_LEN];
     cl_platform_id platform;
     cl_device_id device;
@@ -107,17 +107,15 @@ int main()
     context = clCreateContext(context_properties, 1, &device, NULL, NULL, NULL);
     queue = clCreateCommandQueue(context, device, 0, NULL);
 
+    // tuned launch parameters for this device and N, float4 and the runtime's local size without
+    char problem[STRING_BUFFER_LEN];
+    snprintf(problem, STRING_BUFFER_LEN, "N=%lu", N);
+    tune_table tune;
+    tune_init(&tune, TUNE_FILE, device, problem);
+
     // build kernel
-    unsigned char **opencl_program = read_file("vector_add.cl");
-    program = clCreateProgramWithSource(context, 1, (const char **)opencl_program, NULL, NULL);
-    if (program == NULL)
-    {
-        printf("Program creation failed\n");
-        return 1;
-    }	
-    int success = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if(success != CL_SUCCESS) print_clbuild_errors(program,device);
-    kernel = clCreateKernel(program, "vector_add", NULL);
+    int vec = tune_vec(&tune, "vector_add", 4);
+    kernel = build_vector_add(context, device, vec, &program);
     printf("Kernel build successful\n");
 
 
@@ -211,16 +209,7 @@ int main()
 
     // Set kernel arguments.
     cl_event kernel_event;
-    unsigned argi = 0;
-
-    status = clSetKernelArg(kernel, argi++, sizeof(cl_mem), &input_a_buf);
-    checkError(status, "Failed to set argument 1");
-
-    status = clSetKernelArg(kernel, argi++, sizeof(cl_mem), &input_b_buf);
-    checkError(status, "Failed to set argument 2");
-
-    status = clSetKernelArg(kernel, argi++, sizeof(cl_mem), &output_buf);
-    checkError(status, "Failed to set argument 3");
+    set_vector_add_args(kernel, input_a_buf, input_b_buf, output_buf);
 
     start = chrono::high_resolution_clock::now();
 
@@ -232,8 +221,44 @@ int main()
     clEnqueueUnmapMemObject(queue, input_b_buf, input_b, 0, NULL, NULL);
 #endif // USE_MAP_BUFFER
 
-    const size_t global_work_size = N / 4;
-    status = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_work_size, NULL, 2, write_event, &kernel_event);
+    if (tune_mode) {
+        // every width is a separate build, the local size is tuned for each
+        double best_ms = -1;
+        int best_vec = vec;
+        size_t best_local[3] = {};
+        const int vecs[] = { 1, 2, 4, 8, 16 };
+        for (int v = 0; v < 5; v++) {
+            cl_program tune_program;
+            cl_kernel tune_kernel_vec = build_vector_add(context, device, vecs[v], &tune_program);
+            set_vector_add_args(tune_kernel_vec, input_a_buf, input_b_buf, output_buf);
+            const double ms = tune_kernel(&tune, "vector_add", vecs[v], device, queue, tune_kernel_vec, 1, N / vecs[v], 1);
+            if (ms >= 0 && (best_ms < 0 || ms < best_ms)) {
+                const size_t *local = tune_local(&tune, "vector_add");
+                best_ms = ms;
+                best_vec = vecs[v];
+                for (int d = 0; d < 3; d++)
+                    best_local[d] = local != NULL ? local[d] : 0;
+            }
+            clReleaseKernel(tune_kernel_vec);
+            clReleaseProgram(tune_program);
+        }
+        tune_set(&tune, "vector_add", best_local[0] > 0 ? best_local : NULL, best_vec);
+        tune_save(&tune);
+
+        if (best_vec != vec) {
+            clReleaseKernel(kernel);
+            clReleaseProgram(program);
+            vec = best_vec;
+            kernel = build_vector_add(context, device, vec, &program);
+            set_vector_add_args(kernel, input_a_buf, input_b_buf, output_buf);
+        }
+        start = chrono::high_resolution_clock::now();
+    }
+    printf("%d floats per work-item\n", vec);
+
+    const size_t global_work_size = N / vec;
+    const size_t *local_work_size = tune_local(&tune, "vector_add");
+    status = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_work_size, local_work_size, 2, write_event, &kernel_event);
     checkError(status, "Failed to launch kernel");
 
     status = clWaitForEvents(1, &kernel_event);
@@ -247,7 +272,7 @@ int main()
     start = chrono::high_resolution_clock::now();
     cl_event kernel_event2;
     status = clEnqueueNDRangeKernel(queue, kernel, 1, NULL,
-            &global_work_size, NULL, 2, write_event, &kernel_event2);
+            &global_work_size, local_work_size, 2, write_event, &kernel_event2);
     checkError(status, "Failed to launch kernel");
 
     status = clWaitForEvents(1, &kernel_event2);
@@ -1,8 +1,17 @@
-__kernel void average(__global const uchar4 *in1, 
-                      __global const uchar4 *in2,
-                      __global uchar4 *out)
+#ifndef VEC
+#define VEC 4
+#endif
+
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+#define UCHARN CAT(uchar, VEC)
+
+// VEC pixels per work-item, the autotuner picks it per device
+__kernel void average(__global const UCHARN *in1, 
+                      __global const UCHARN *in2,
+                      __global UCHARN *out)
 {
     int gid = get_global_id(0);
-    uchar4 div = (uchar4)(2);
+    UCHARN div = (UCHARN)(2);
     out[gid] = in1[gid] / div + in2[gid] / div;
 }
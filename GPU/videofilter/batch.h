@@ -0,0 +1,134 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <chrono>
+#include <CL/cl.h>
+#include "opencv2/opencv.hpp"
+
+#include "helpers.h"
+#include "stages.h"
+#include "profile.h"
+#include "source.h"
+#include "sink.h"
+
+#define MAX_BATCH 32
+
+
+// filters batch frames per launch. the frames are decoded back to back into one
+// gray buffer and every stage runs once over all of them, with the frame index
+// as the third dimension of the 2D kernels. gpu has to be set up for the batch,
+// i.e. its scratch buffers, frame_size_bytes and conv cover batch frames. the
+// warm-up is rounded up to whole batches. returns the number of measured frames,
+// their total time in wall_ms and the time from submit to mapped result in filter_ms
+int run_batched(gpu_stages *gpu, cl_context context, frame_source *camera, frame_sink *output,
+                cv::Size size, int warmup, int max_frames, int batch, bool show, const char *window_name,
+                double *wall_ms, double *filter_ms)
+{
+    int status;
+    const size_t frame_px = (size_t)size.width * size.height;
+    const size_t batch_bytes = frame_px * batch * sizeof(unsigned char);
+
+    cl_mem gray_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, batch_bytes, NULL, &status);
+    checkError(status, "Failed to allocate batch gray buffer");
+    cl_mem edge_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, batch_bytes, NULL, &status);
+    checkError(status, "Failed to allocate batch edge buffer");
+
+    unsigned char *gray_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, gray_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, batch_bytes, 0, NULL, NULL, &status);
+    checkError(status, "Failed to map batch gray buffer");
+    unsigned char *edge_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, batch_bytes, 0, NULL, NULL, &status);
+    checkError(status, "Failed to map batch edge buffer");
+
+    const int warmup_batches = (warmup + batch - 1) / batch;
+    const int total_frames = warmup_batches * batch + max_frames;
+    int count = 0;
+    double tot_ms = 0;
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    for (int first = 0, b = 0; first < total_frames; first += batch, b++) {
+        const bool measured = b >= warmup_batches;
+        if (b == warmup_batches)
+            wall_start = std::chrono::high_resolution_clock::now();
+
+        // the last batch can be short, the frames after n are filtered but not written
+        int n = 0;
+        auto load_start = std::chrono::high_resolution_clock::now();
+        while (n < batch && first + n < total_frames) {
+            if (!source_read(camera, gray_ptr + n * frame_px, size.width, NULL))
+                break;
+            n++;
+        }
+        auto load_end = std::chrono::high_resolution_clock::now();
+        if (n == 0)
+            break;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        cl_event unmap_events[2];
+        frame_events events;
+        clEnqueueUnmapMemObject(gpu->queue, gray_cl, gray_ptr, 0, NULL, &unmap_events[0]);
+        clEnqueueUnmapMemObject(gpu->queue, edge_cl, edge_ptr, 0, NULL, &unmap_events[1]);
+        profile_add(gpu->prof, "unmap", unmap_events[0]);
+        profile_add(gpu->prof, "unmap", unmap_events[1]);
+
+        status = enqueue_gpu_stages(gpu, NULL, gray_cl, edge_cl, 2, unmap_events, &events);
+        checkError(status, "Failed to enqueue gpu stages for the batch");
+
+        cl_event map_events[2];
+        gray_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, gray_cl, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, batch_bytes, 1, &events.last, &map_events[0], &status);
+        checkError(status, "Failed to map batch gray buffer");
+        edge_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, batch_bytes, 1, &events.last, &map_events[1], &status);
+        checkError(status, "Failed to map batch edge buffer");
+        clWaitForEvents(2, map_events);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < 2; i++) {
+            profile_add(gpu->prof, "map", map_events[i]);
+            clReleaseEvent(map_events[i]);
+            clReleaseEvent(unmap_events[i]);
+        }
+        frame_events_release(&events);
+        profile_collect(gpu->prof, measured);
+
+        auto disp_start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n; i++) {
+            cv::Mat displayframe(size, CV_8U, gray_ptr + i * frame_px);
+            cv::Mat edge(size, CV_8U, edge_ptr + i * frame_px);
+            cv::bitwise_and(displayframe, edge, displayframe);
+            sink_write(output, displayframe.data, displayframe.step);
+
+            if (show) {
+                cv::imshow(window_name, displayframe);
+                cv::waitKey(1);
+            }
+        }
+        auto disp_end = std::chrono::high_resolution_clock::now();
+
+        auto load_dur = std::chrono::duration_cast<std::chrono::microseconds>(load_end - load_start).count() / 1000.0;
+        auto diff = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+        auto disp_dur = std::chrono::duration_cast<std::chrono::microseconds>(disp_end - disp_start).count() / 1000.0;
+        printf("batch of %d: load: %.3f ms  filter: %.3f ms (%.3f ms per frame)  disp: %.3f ms\n", n, load_dur, diff, diff / n, disp_dur);
+
+        if (measured) {
+            tot_ms += diff;
+            count += n;
+        }
+        if (n < batch)
+            break;
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+    *wall_ms = std::chrono::duration_cast<std::chrono::microseconds>(wall_end - wall_start).count() / 1000.0;
+    *filter_ms = tot_ms;
+    printf("batched by %d: %d frames, FPS: %.2lf (filtering only), %.2lf (including load and disp)\n",
+           batch, count, 1000.0 * count / tot_ms, 1000.0 * count / *wall_ms);
+
+    clEnqueueUnmapMemObject(gpu->queue, gray_cl, gray_ptr, 0, NULL, NULL);
+    clEnqueueUnmapMemObject(gpu->queue, edge_cl, edge_ptr, 0, NULL, NULL);
+    clFinish(gpu->queue);
+    clReleaseMemObject(gray_cl);
+    clReleaseMemObject(edge_cl);
+
+    return count;
+}
+
+#endif // BATCH_H
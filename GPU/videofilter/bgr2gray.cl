@@ -0,0 +1,49 @@
+// same fixed point weights and rounding as opencv's cvtColor(CV_BGR2GRAY)
+#define GRAY_B 1868
+#define GRAY_G 9617
+#define GRAY_R 4899
+#define GRAY_SHIFT 14
+
+inline int bgr_to_gray(__global const uchar *in, int idx)
+{
+    int3 p = convert_int3(vload3(idx, in));
+    return (p.x * GRAY_B + p.y * GRAY_G + p.z * GRAY_R + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT;
+}
+
+// packed bgr frame straight from the decoder to gray, written with the
+// pitch and origin of the gray layout
+__kernel void bgr2gray(__global const uchar *in,
+                       __global uchar *out,
+                       const int width,
+                       const int height,
+                       const int pitch,
+                       const int origin)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    out[origin + y * pitch + x] = (uchar)bgr_to_gray(in, y * width + x);
+}
+
+// bgr2gray and the first 3x3 1-2-1 gaussian pass in one go. the gray values of
+// the neighbours are recomputed rather than stored, which is cheaper than a
+// round trip through memory. edges are clamped
+__kernel void bgr2gray_gauss3(__global const uchar *in,
+                              __global uchar *out,
+                              const int width,
+                              const int height,
+                              const int pitch,
+                              const int origin)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int w[3] = { 1, 2, 1 };
+
+    int acc = 0;
+    for (int i = 0; i < 3; i++) {
+        const int row = clamp(y + i - 1, 0, height - 1) * width;
+        for (int j = 0; j < 3; j++)
+            acc += w[i] * w[j] * bgr_to_gray(in, row + clamp(x + j - 1, 0, width - 1));
+    }
+    out[origin + y * pitch + x] = (uchar)(acc >> 4);
+}
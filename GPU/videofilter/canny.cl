@@ -0,0 +1,168 @@
+#ifndef TILE_W
+#define TILE_W 16
+#endif
+#ifndef TILE_H
+#define TILE_H 16
+#endif
+
+#define WG_SIZE (TILE_W * TILE_H)
+
+// what canny_nms and the hysteresis passes leave for every pixel
+#define NOT_EDGE 0
+#define WEAK 1
+#define STRONG 2
+
+// the gradient needs one pixel of apron and the suppression one more for the
+// magnitude of the neighbours it compares against
+#define PX_W (TILE_W + 4)
+#define PX_H (TILE_H + 4)
+#define MAG_W (TILE_W + 2)
+#define MAG_H (TILE_H + 2)
+
+// tan(22.5) and tan(67.5) split the gradient directions into four sectors
+#define TAN_22_5 0.41421356f
+#define TAN_67_5 2.41421356f
+
+// same scharr weights as sobel_x_kern and sobel_y_kern in videofilter.cpp, p
+// points into a buffer PX_W wide
+int2 scharr(__local const uchar *p)
+{
+    int gx = -3 * p[-PX_W - 1] + 3 * p[-PX_W + 1]
+            - 10 * p[-1]       + 10 * p[1]
+            - 3 * p[PX_W - 1]  + 3 * p[PX_W + 1];
+    int gy = -3 * p[-PX_W - 1] - 10 * p[-PX_W] - 3 * p[-PX_W + 1]
+            + 3 * p[PX_W - 1]  + 10 * p[PX_W]  + 3 * p[PX_W + 1];
+    return (int2)(gx, gy);
+}
+
+// gradient of the blurred frame, non-maximum suppression along its direction
+// and the double threshold, one tile per work-group. the magnitude is scaled
+// down by the 16 the scharr weights add up to, so low and high are in gray
+// levels per pixel. pixels outside the frame are clamped to the edge. in and
+// labels have the layout pitch and origin give
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void canny_nms(__global const uchar *in,
+               __global uchar *labels,
+               const int width,
+               const int height,
+               const int pitch,
+               const int origin,
+               const float low,
+               const float high)
+{
+    __local uchar px[PX_W * PX_H];
+    __local float mag[MAG_W * MAG_H];
+
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int lid = get_local_id(1) * TILE_W + get_local_id(0);
+    const int x0 = get_group_id(0) * TILE_W - 2;
+    const int y0 = get_group_id(1) * TILE_H - 2;
+
+    for (int i = lid; i < PX_W * PX_H; i += WG_SIZE) {
+        int gx = clamp(x0 + i % PX_W, 0, width - 1);
+        int gy = clamp(y0 + i / PX_W, 0, height - 1);
+        px[i] = in[origin + gy * pitch + gx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int i = lid; i < MAG_W * MAG_H; i += WG_SIZE) {
+        int2 g = scharr(px + (i / MAG_W + 1) * PX_W + i % MAG_W + 1);
+        mag[i] = hypot((float)g.x, (float)g.y) / 16.0f;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (x >= width || y >= height)
+        return;
+
+    const int2 g = scharr(px + (get_local_id(1) + 2) * PX_W + get_local_id(0) + 2);
+    __local const float *m = mag + (get_local_id(1) + 1) * MAG_W + get_local_id(0) + 1;
+    const float ax = fabs((float)g.x);
+    const float ay = fabs((float)g.y);
+
+    // the two neighbours across the edge, the diagonals depend on whether
+    // the gradient components have the same sign
+    float a, b;
+    if (ay <= TAN_22_5 * ax) {
+        a = m[-1];
+        b = m[1];
+    } else if (ay >= TAN_67_5 * ax) {
+        a = m[-MAG_W];
+        b = m[MAG_W];
+    } else if ((g.x ^ g.y) < 0) {
+        a = m[-MAG_W + 1];
+        b = m[MAG_W - 1];
+    } else {
+        a = m[-MAG_W - 1];
+        b = m[MAG_W + 1];
+    }
+
+    // ties go to the later pixel, so a flat ridge two pixels wide stays one pixel wide
+    uchar label = NOT_EDGE;
+    if (m[0] > a && m[0] >= b && m[0] > low)
+        label = m[0] > high ? STRONG : WEAK;
+    labels[origin + y * pitch + x] = label;
+}
+
+// promotes weak pixels that touch a strong one. the tile is loaded with one
+// pixel of apron and grown in local memory until nothing changes, so an edge
+// is followed through the whole tile in one pass and into the next tile with
+// every further pass
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void canny_hysteresis(__global const uchar *in,
+                      __global uchar *out,
+                      const int width,
+                      const int height,
+                      const int pitch,
+                      const int origin)
+{
+    __local uchar lab[MAG_W * MAG_H];
+    __local int changed;
+
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int lid = get_local_id(1) * TILE_W + get_local_id(0);
+    const int x0 = get_group_id(0) * TILE_W - 1;
+    const int y0 = get_group_id(1) * TILE_H - 1;
+    const bool inside = x < width && y < height;
+
+    for (int i = lid; i < MAG_W * MAG_H; i += WG_SIZE) {
+        int gx = x0 + i % MAG_W;
+        int gy = y0 + i / MAG_W;
+        lab[i] = gx >= 0 && gx < width && gy >= 0 && gy < height ? in[origin + gy * pitch + gx] : NOT_EDGE;
+    }
+
+    __local uchar *p = lab + (get_local_id(1) + 1) * MAG_W + get_local_id(0) + 1;
+    bool again = true;
+    while (again) {
+        if (lid == 0)
+            changed = 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (inside && p[0] == WEAK &&
+            (p[-MAG_W - 1] == STRONG || p[-MAG_W] == STRONG || p[-MAG_W + 1] == STRONG ||
+             p[-1] == STRONG         || p[1] == STRONG ||
+             p[MAG_W - 1] == STRONG  || p[MAG_W] == STRONG  || p[MAG_W + 1] == STRONG)) {
+            p[0] = STRONG;
+            changed = 1;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        again = changed != 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (inside)
+        out[origin + y * pitch + x] = p[0];
+}
+
+// turns the labels into the same mask the threshold stage makes: 0 on the
+// edges, maxval everywhere else. weak pixels that never got promoted are dropped.
+// it goes over the whole buffer, the border and the padding too
+__kernel void canny_mask(__global const uchar16 *labels,
+                         __global uchar16 *out,
+                         const int maxval)
+{
+    int idx = get_global_id(0);
+    uchar16 mv = (uchar16)(maxval);
+    out[idx] = labels[idx] == (uchar16)(STRONG) ? (uchar16)(0) : mv;
+}
@@ -0,0 +1,212 @@
+#ifndef CONV_JIT_H
+#define CONV_JIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <CL/cl.h>
+
+#include "helpers.h"
+
+#define MAX_FILTER_SIZE 15
+#define JIT_CACHE_SIZE 8
+
+// largest sum of |scaled weight| for which 255 * sum still fits in an int
+#define JIT_MAX_INT_SUM (1 << 22)
+
+// largest gaussian --conv int takes, the binomial weights of an n x n one are
+// k/2^(2n-2) and jit_scale_bits stops at 2^16
+#define INT_MAX_BLUR 9
+
+
+// one specialized program per distinct filter
+struct jit_entry {
+    int size;
+    float weights[MAX_FILTER_SIZE * MAX_FILTER_SIZE];
+    cl_program program;
+    cl_kernel kernel;
+};
+
+struct jit_cache {
+    jit_entry entries[JIT_CACHE_SIZE];
+    int count;      // total number of programs built, the oldest entry is replaced when full
+};
+
+// returns n if |w| == 2^n, -1 otherwise
+static int pow2_shift(int w)
+{
+    w = abs(w);
+    if (w == 0 || (w & (w - 1)) != 0)
+        return -1;
+
+    int shift = 0;
+    while ((1 << shift) != w)
+        shift++;
+    return shift;
+}
+
+// smallest k so that every weight * 2^k is an integer, -1 if there isn't one
+// that keeps the integer sum from overflowing
+static int jit_scale_bits(const float *weights, int taps)
+{
+    for (int k = 0; k <= 16; k++) {
+        bool exact = true;
+        float sum = 0;
+        for (int i = 0; i < taps && exact; i++) {
+            float scaled = weights[i] * (1 << k);
+            exact = scaled == floorf(scaled);
+            sum += fabsf(scaled);
+        }
+        if (exact)
+            return sum <= JIT_MAX_INT_SUM ? k : -1;
+    }
+    return -1;
+}
+
+static void append(std::string &src, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void append(std::string &src, const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    src += line;
+}
+
+// emits a convolve_jit kernel with the size and weights of the filter baked in.
+// zero taps are left out. when all weights are k/2^n the sum is done in integers,
+// with power-of-two weights as shifts, and shifted down by n at the end. padded
+// frames have a border of at least the radius, their taps aren't clamped
+void jit_convolution_source(const float *weights, int size, bool padded, std::string &src)
+{
+    const int radius = size / 2;
+    const int scale_bits = jit_scale_bits(weights, size * size);
+    bool row_used[MAX_FILTER_SIZE] = { false };
+    bool col_used[MAX_FILTER_SIZE] = { false };
+
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            if (weights[i * size + j] != 0) {
+                row_used[i] = true;
+                col_used[j] = true;
+            }
+        }
+    }
+
+    src.clear();
+    append(src, "// generated for a %dx%d filter%s\n", size, size, padded ? " on padded frames" : "");
+    src += "__kernel void convolve_jit(__global const uchar *in,\n"
+           "                           __global uchar *out,\n"
+           "                           const int width,\n"
+           "                           const int height,\n"
+           "                           const int pitch,\n"
+           "                           const int origin)\n"
+           "{\n"
+           "    const int x = get_global_id(0);\n"
+           "    const int y = get_global_id(1);\n"
+           "    const size_t frame = origin + get_global_id(2) * (size_t)pitch * height;\n"
+           "    in += frame;\n"
+           "    out += frame;\n";
+
+    // rows and columns are clamped to the frame unless it is padded, and only the ones with a tap are emitted
+    for (int i = 0; i < size; i++) {
+        if (i == radius)
+            append(src, "    __global const uchar *r%d = in + y * pitch;\n", i);
+        else if (row_used[i] && padded)
+            append(src, "    __global const uchar *r%d = in + (y + (%d)) * pitch;\n", i, i - radius);
+        else if (row_used[i])
+            append(src, "    __global const uchar *r%d = in + clamp(y + (%d), 0, height - 1) * pitch;\n", i, i - radius);
+    }
+    for (int j = 0; j < size; j++) {
+        if (j == radius)
+            append(src, "    const int c%d = x;\n", j);
+        else if (col_used[j] && padded)
+            append(src, "    const int c%d = x + (%d);\n", j, j - radius);
+        else if (col_used[j])
+            append(src, "    const int c%d = clamp(x + (%d), 0, width - 1);\n", j, j - radius);
+    }
+
+    src += scale_bits >= 0 ? "    int acc = 0;\n" : "    float acc = 0;\n";
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            const float w = weights[i * size + j];
+            if (w == 0)
+                continue;
+
+            if (scale_bits >= 0) {
+                const int iw = (int)(w * (1 << scale_bits));
+                const int shift = pow2_shift(iw);
+                const char op = iw < 0 ? '-' : '+';
+                if (shift == 0)
+                    append(src, "    acc %c= r%d[c%d];\n", op, i, j);
+                else if (shift > 0)
+                    append(src, "    acc %c= r%d[c%d] << %d;\n", op, i, j, shift);
+                else
+                    append(src, "    acc += r%d[c%d] * %d;\n", i, j, iw);
+            } else {
+                if (w == 1 || w == -1)
+                    append(src, "    acc %c= r%d[c%d];\n", w < 0 ? '-' : '+', i, j);
+                else
+                    append(src, "    acc += r%d[c%d] * %.9ef;\n", i, j, w);
+            }
+        }
+    }
+
+    // >> floors instead of truncating, which only differs for negative sums and those saturate to 0 anyway
+    if (scale_bits > 0)
+        append(src, "    out[y * pitch + x] = convert_uchar_sat(acc >> %d);\n", scale_bits);
+    else
+        src += "    out[y * pitch + x] = convert_uchar_sat(acc);\n";
+    src += "}\n";
+}
+
+void jit_cache_init(jit_cache *cache)
+{
+    cache->count = 0;
+}
+
+// returns the specialized kernel for the filter, building it the first time it
+// is seen. a cache is only ever used for one layout, so padded isn't part of the key
+cl_kernel jit_cache_get(jit_cache *cache, cl_context context, cl_device_id device, const float *weights, int size, bool padded)
+{
+    const int cached = cache->count < JIT_CACHE_SIZE ? cache->count : JIT_CACHE_SIZE;
+    for (int i = 0; i < cached; i++) {
+        jit_entry *entry = &cache->entries[i];
+        if (entry->size == size && memcmp(entry->weights, weights, size * size * sizeof(float)) == 0)
+            return entry->kernel;
+    }
+
+    jit_entry *entry = &cache->entries[cache->count % JIT_CACHE_SIZE];
+    if (cache->count >= JIT_CACHE_SIZE) {
+        clReleaseKernel(entry->kernel);
+        clReleaseProgram(entry->program);
+    }
+    cache->count++;
+
+    std::string src;
+    jit_convolution_source(weights, size, padded, src);
+
+    int status;
+    entry->size = size;
+    memcpy(entry->weights, weights, size * size * sizeof(float));
+    entry->program = build_program_source(context, device, src.c_str(), NULL);
+    entry->kernel = clCreateKernel(entry->program, "convolve_jit", &status);
+    checkError(status, "Failed to create convolve_jit kernel");
+    return entry->kernel;
+}
+
+void jit_cache_release(jit_cache *cache)
+{
+    const int cached = cache->count < JIT_CACHE_SIZE ? cache->count : JIT_CACHE_SIZE;
+    for (int i = 0; i < cached; i++) {
+        clReleaseKernel(cache->entries[i].kernel);
+        clReleaseProgram(cache->entries[i].program);
+    }
+    cache->count = 0;
+}
+
+#endif // CONV_JIT_H
@@ -0,0 +1,705 @@
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <CL/cl.h>
+
+#include "helpers.h"
+#include "conv_jit.h"
+#include "frame.h"
+#include "tune.h"
+
+
+enum conv_impl {
+    CONV_NAIVE,     // convolve.cl, 1D range with every tap read from global memory
+    CONV_TILED,     // convolve_tiled.cl, 2D range with a local memory tile
+    CONV_SEPARABLE, // separable.cl, row pass + column pass for rank 1 filters
+    CONV_JIT,       // generated per filter with the weights as constants, see conv_jit.h
+    CONV_IMAGE,     // convolve_image.cl, input copied to a 2D image and read through a clamping sampler
+    CONV_INT        // convolve_int.cl, fixed point with several pixels per work-item for k/2^n weights
+};
+
+const char *conv_impl_name(conv_impl impl)
+{
+    switch (impl) {
+    case CONV_TILED: return "tiled";
+    case CONV_SEPARABLE: return "separable";
+    case CONV_JIT: return "jit";
+    case CONV_IMAGE: return "image";
+    case CONV_INT: return "int";
+    case CONV_NAIVE:
+    default: return "naive";
+    }
+}
+
+// a size x size filter. when it is separable, weights[i * size + j] == col[i] * row[j]
+struct conv_filter {
+    int size;
+    float weights[MAX_FILTER_SIZE * MAX_FILTER_SIZE];
+    cl_mem weights_cl;
+
+    bool separable;
+    float col[MAX_FILTER_SIZE];
+    float row[MAX_FILTER_SIZE];
+    cl_mem col_cl, row_cl;
+
+    // weights = iweights / 2^int_shift when int_shift >= 0
+    int int_shift;
+    bool int_short;     // 255 * sum |iweights| fits a short
+    cl_mem iweights_cl;
+};
+
+struct conv_stage {
+    conv_impl impl;
+    int width, height;
+    int batch;      // frames stored back to back in every buffer, the third dimension of the launches
+    frame_layout layout;    // of the frames in and out, a batch is always packed
+
+    // with the padded layout the border of the input is refreshed before every
+    // convolution, so the kernels read it instead of clamping
+    frame_padder padder;
+
+    // tuned local sizes, looked up by kernel name at every launch. the tiled
+    // kernel keeps the tile size it was built for
+    const tune_table *tune;
+
+    // two instances of every kernel below, so both halves of a pair can be in
+    // flight at the same time on an out-of-order queue or on two queues
+
+    // naive and tiled, also the fallback for filters that are not separable
+    cl_program program;
+    cl_kernel kernel[2];
+    cl_uint dim;
+    size_t global_size[3];
+    size_t local_size[3];
+
+    // separable
+    cl_program sep_program;
+    cl_kernel row_kernel[2], row2_kernel, col_kernel[2];
+    cl_mem tmp[2];  // float row pass results, one per instance
+
+    // image
+    cl_program img_program;
+    cl_kernel img_kernel[2];
+    cl_mem img[2];  // CL_R / CL_UNORM_INT8 copies of the input, one per instance
+
+    // integer, [0] accumulates in short and [1] in int
+    cl_program int_program[2];
+    cl_kernel int_kernel[2][2];     // [accumulator][instance]
+    size_t int_global_size[3];
+
+    // jit
+    cl_context context;
+    cl_device_id device;
+    jit_cache jit;
+};
+
+// true if x has at most 10 fractional bits, i.e. products of such factors are exact in float
+static bool is_dyadic(float x)
+{
+    return x * 1024.0f == floorf(x * 1024.0f);
+}
+
+// tries to split weights into col x row. the pivot row is used as is and the
+// pivot column is divided by the pivot, unless that gives inexact factors and
+// the other way round doesn't (sobel y is [-10 0 10] x [0.3 1 0.3] one way and
+// [1 0 -1] x [-3 -10 -3] the other)
+bool separate_filter(const float *weights, int size, float *col, float *row)
+{
+    int pivot = 0;
+    for (int i = 1; i < size * size; i++) {
+        if (fabsf(weights[i]) > fabsf(weights[pivot]))
+            pivot = i;
+    }
+    const int r0 = pivot / size;
+    const int c0 = pivot % size;
+    const float p = weights[pivot];
+    if (p == 0)
+        return false;
+
+    bool exact = true;
+    for (int i = 0; i < size; i++) {
+        col[i] = weights[i * size + c0];
+        row[i] = weights[r0 * size + i] / p;
+        exact = exact && is_dyadic(col[i]) && is_dyadic(row[i]);
+    }
+    if (!exact) {
+        for (int i = 0; i < size; i++) {
+            col[i] = weights[i * size + c0] / p;
+            row[i] = weights[r0 * size + i];
+        }
+    }
+
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            if (fabsf(weights[i * size + j] - col[i] * row[j]) > 1e-6f * fabsf(p))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void conv_filter_upload(conv_filter *filter, cl_context context)
+{
+    int status;
+    const int n = filter->size;
+
+    filter->weights_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * n * sizeof(float), filter->weights, &status);
+    checkError(status, "Failed to allocate filter weights buffer");
+
+    filter->col_cl = NULL;
+    filter->row_cl = NULL;
+    if (filter->separable) {
+        filter->col_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float), filter->col, &status);
+        checkError(status, "Failed to allocate filter column buffer");
+        filter->row_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float), filter->row, &status);
+        checkError(status, "Failed to allocate filter row buffer");
+    }
+
+    int iweights[MAX_FILTER_SIZE * MAX_FILTER_SIZE];
+    int sum = 0;
+    filter->int_shift = jit_scale_bits(filter->weights, n * n);
+    filter->iweights_cl = NULL;
+    if (filter->int_shift >= 0) {
+        for (int i = 0; i < n * n; i++) {
+            iweights[i] = (int)(filter->weights[i] * (1 << filter->int_shift));
+            sum += abs(iweights[i]);
+        }
+        filter->int_short = 255 * sum <= 32767;
+        filter->iweights_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * n * sizeof(int), iweights, &status);
+        checkError(status, "Failed to allocate filter integer weights buffer");
+    }
+}
+
+// full size x size weights, checks whether the filter is separable
+void conv_filter_init(conv_filter *filter, cl_context context, const float *weights, int size)
+{
+    if (size % 2 == 0 || size > MAX_FILTER_SIZE) {
+        printf("unsupported filter size %d\n", size);
+        exit(-1);
+    }
+
+    filter->size = size;
+    for (int i = 0; i < size * size; i++)
+        filter->weights[i] = weights[i];
+    filter->separable = separate_filter(weights, size, filter->col, filter->row);
+
+    conv_filter_upload(filter, context);
+}
+
+// separable filter given as its 1D factors
+void conv_filter_init_separable(conv_filter *filter, cl_context context, const float *col, const float *row, int size)
+{
+    if (size % 2 == 0 || size > MAX_FILTER_SIZE) {
+        printf("unsupported filter size %d\n", size);
+        exit(-1);
+    }
+
+    filter->size = size;
+    filter->separable = true;
+    for (int i = 0; i < size; i++) {
+        filter->col[i] = col[i];
+        filter->row[i] = row[i];
+        for (int j = 0; j < size; j++)
+            filter->weights[i * size + j] = col[i] * row[j];
+    }
+
+    conv_filter_upload(filter, context);
+}
+
+// normalized binomial approximation of a size x size gaussian, 1-2-1 x 1-2-1 / 16 for size 3
+void conv_filter_init_gaussian(conv_filter *filter, cl_context context, int size)
+{
+    float factor[MAX_FILTER_SIZE];
+    float sum = 0;
+
+    if (size % 2 == 0 || size > MAX_FILTER_SIZE) {
+        printf("unsupported filter size %d\n", size);
+        exit(-1);
+    }
+
+    factor[0] = 1;
+    for (int i = 1; i < size; i++)
+        factor[i] = factor[i - 1] * (size - i) / i;
+    for (int i = 0; i < size; i++)
+        sum += factor[i];
+    for (int i = 0; i < size; i++)
+        factor[i] /= sum;
+
+    conv_filter_init_separable(filter, context, factor, factor, size);
+}
+
+void conv_filter_release(conv_filter *filter)
+{
+    clReleaseMemObject(filter->weights_cl);
+    if (filter->separable) {
+        clReleaseMemObject(filter->col_cl);
+        clReleaseMemObject(filter->row_cl);
+    }
+    if (filter->iweights_cl != NULL)
+        clReleaseMemObject(filter->iweights_cl);
+}
+
+// the 3x3 convolve.cl kernels, also the fallback of the separable and integer versions.
+// the kernel is 1D and doesn't look at the frame borders, so a batch is just a longer range
+static void conv_init_naive(conv_stage *conv, cl_context context, cl_device_id device, int width, int height)
+{
+    int status;
+
+    conv->program = build_program(context, device, "convolve.cl", NULL);
+    conv->dim = 1;
+    conv->global_size[0] = (size_t)width * height * conv->batch;
+    conv->global_size[1] = 1;
+    conv->global_size[2] = 1;
+
+    for (int k = 0; k < 2; k++) {
+        conv->kernel[k] = clCreateKernel(conv->program, "convolve", &status);
+        checkError(status, "Failed to create convolve kernel");
+        frame_set_args(conv->kernel[k], 2, &conv->layout, "convolve");
+    }
+}
+
+// builds the kernels for impl and works out the launch size for batch frames in
+// layout. the image version only does one packed frame at a time. tune may be NULL
+void conv_init(conv_stage *conv, conv_impl impl, cl_context context, cl_device_id device,
+               const frame_layout *layout, int batch, int tile_w, int tile_h, const tune_table *tune)
+{
+    int status;
+    char build_options[256];
+    const int width = layout->width;
+    const int height = layout->height;
+    const bool padded = layout->border > 0;
+
+    if (impl == CONV_IMAGE && batch > 1) {
+        printf("--conv image can't convolve a batch of frames\n");
+        exit(-1);
+    }
+    // the upload to the image only copies packed rows
+    if (impl == CONV_IMAGE && padded) {
+        printf("--conv image can't convolve padded frames\n");
+        exit(-1);
+    }
+    if (padded && batch > 1) {
+        printf("a batch of frames is always packed\n");
+        exit(-1);
+    }
+
+    conv->impl = impl;
+    conv->width = width;
+    conv->height = height;
+    conv->batch = batch;
+    conv->layout = *layout;
+    conv->tune = tune;
+    frame_padder_init(&conv->padder, context, device, layout);
+    conv->sep_program = NULL;
+    conv->img_program = NULL;
+    conv->int_program[0] = NULL;
+    conv->program = NULL;
+    conv->context = context;
+    conv->device = device;
+    jit_cache_init(&conv->jit);
+
+    switch (impl) {
+    case CONV_TILED:
+        snprintf(build_options, sizeof(build_options), "-DTILE_W=%d -DTILE_H=%d", tile_w, tile_h);
+        conv->program = build_program(context, device, "convolve_tiled.cl", build_options);
+        conv->dim = 3;
+        conv->local_size[0] = tile_w;
+        conv->local_size[1] = tile_h;
+        conv->local_size[2] = 1;
+        conv->global_size[0] = (width + tile_w - 1) / tile_w * tile_w;
+        conv->global_size[1] = (height + tile_h - 1) / tile_h * tile_h;
+        conv->global_size[2] = batch;
+
+        for (int k = 0; k < 2; k++) {
+            conv->kernel[k] = clCreateKernel(conv->program, "convolve_tiled", &status);
+            checkError(status, "Failed to create convolve_tiled kernel");
+            frame_set_args(conv->kernel[k], 2, layout, "convolve_tiled");
+        }
+        break;
+
+    case CONV_JIT:
+        // kernels are built per filter by conv_prepare or on first use
+        conv->dim = 3;
+        conv->global_size[0] = width;
+        conv->global_size[1] = height;
+        conv->global_size[2] = batch;
+        break;
+
+    case CONV_IMAGE: {
+        cl_bool image_support = CL_FALSE;
+        clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(image_support), &image_support, NULL);
+        if (!image_support) {
+            printf("device has no image support, can't use --conv image\n");
+            exit(-1);
+        }
+
+        const cl_image_format format = { CL_R, CL_UNORM_INT8 };
+        conv->img_program = build_program(context, device, "convolve_image.cl", NULL);
+        for (int k = 0; k < 2; k++) {
+            conv->img_kernel[k] = clCreateKernel(conv->img_program, "convolve_image", &status);
+            checkError(status, "Failed to create convolve_image kernel");
+            conv->img[k] = clCreateImage2D(context, CL_MEM_READ_ONLY, &format, width, height, 0, NULL, &status);
+            checkError(status, "Failed to allocate convolution input image");
+
+            frame_set_args(conv->img_kernel[k], 2, layout, "convolve_image");
+        }
+
+        conv->dim = 2;
+        conv->global_size[0] = width;
+        conv->global_size[1] = height;
+        conv->global_size[2] = 1;
+        break;
+    }
+
+    case CONV_INT: {
+        // one work-item per 8 pixels, or 16 on devices that like wide short vectors
+        cl_uint preferred = 1;
+        clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT, sizeof(preferred), &preferred, NULL);
+        const int vec = preferred > 8 ? 16 : 8;
+        printf("integer convolution with %d pixels per work-item (preferred short width %u)\n", vec, preferred);
+
+        const char *acc_types[2] = { "short", "int" };
+        for (int a = 0; a < 2; a++) {
+            snprintf(build_options, sizeof(build_options), "-DVEC=%d -DACC=%s%s", vec, acc_types[a], padded ? " -DPADDED" : "");
+            conv->int_program[a] = build_program(context, device, "convolve_int.cl", build_options);
+            for (int k = 0; k < 2; k++) {
+                conv->int_kernel[a][k] = clCreateKernel(conv->int_program[a], "convolve_int", &status);
+                checkError(status, "Failed to create convolve_int kernel");
+                frame_set_args(conv->int_kernel[a][k], 2, layout, "convolve_int");
+            }
+        }
+        conv->int_global_size[0] = (width + vec - 1) / vec;
+        conv->int_global_size[1] = height;
+        conv->int_global_size[2] = batch;
+
+        // 3x3 filters without an integer form use the naive kernel
+        conv_init_naive(conv, context, device, width, height);
+        break;
+    }
+
+    case CONV_SEPARABLE:
+        conv->sep_program = build_program(context, device, "separable.cl", padded ? "-DPADDED" : NULL);
+        conv->row2_kernel = clCreateKernel(conv->sep_program, "row_pass2", &status);
+        checkError(status, "Failed to create row_pass2 kernel");
+        frame_set_args(conv->row2_kernel, 3, layout, "row_pass2");
+
+        for (int k = 0; k < 2; k++) {
+            conv->row_kernel[k] = clCreateKernel(conv->sep_program, "row_pass", &status);
+            checkError(status, "Failed to create row_pass kernel");
+            conv->col_kernel[k] = clCreateKernel(conv->sep_program, "col_pass", &status);
+            checkError(status, "Failed to create col_pass kernel");
+            conv->tmp[k] = clCreateBuffer(context, CL_MEM_READ_WRITE, (size_t)width * height * batch * sizeof(float), NULL, &status);
+            checkError(status, "Failed to allocate separable scratch buffer");
+
+            frame_set_args(conv->row_kernel[k], 2, layout, "row_pass");
+            frame_set_args(conv->col_kernel[k], 2, layout, "col_pass");
+        }
+
+        // 3x3 filters that aren't separable use the naive kernel
+        conv_init_naive(conv, context, device, width, height);
+        break;
+
+    case CONV_NAIVE:
+    default:
+        conv_init_naive(conv, context, device, width, height);
+        break;
+    }
+}
+
+static cl_int conv_enqueue_col(conv_stage *conv, int k, cl_command_queue queue, cl_mem out, const conv_filter *filter,
+                               cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+    int status;
+    const int radius = filter->size / 2;
+    const size_t global_size[3] = { (size_t)conv->width, (size_t)conv->height, (size_t)conv->batch };
+    cl_kernel col_kernel = conv->col_kernel[k];
+
+    status = clSetKernelArg(col_kernel, 0, sizeof(cl_mem), &conv->tmp[k]);
+    checkError(status, "Failed to set col_pass input arg");
+    status = clSetKernelArg(col_kernel, 1, sizeof(cl_mem), &out);
+    checkError(status, "Failed to set col_pass output arg");
+    status = clSetKernelArg(col_kernel, 6, sizeof(int), &radius);
+    checkError(status, "Failed to set col_pass radius arg");
+    status = clSetKernelArg(col_kernel, 7, sizeof(cl_mem), &filter->col_cl);
+    checkError(status, "Failed to set col_pass weights arg");
+
+    return clEnqueueNDRangeKernel(queue, col_kernel, 3, NULL, global_size, tune_local(conv->tune, "col_pass"),
+                                  num_events, wait_list, event);
+}
+
+// copies the frame in into image k, the frames themselves stay buffers
+static cl_int conv_enqueue_upload(conv_stage *conv, int k, cl_command_queue queue, cl_mem in,
+                                  cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { (size_t)conv->width, (size_t)conv->height, 1 };
+    return clEnqueueCopyBufferToImage(queue, in, conv->img[k], 0, origin, region, num_events, wait_list, event);
+}
+
+// convolves image `img` into out with the image kernel instance k
+static cl_int conv_enqueue_image(conv_stage *conv, int k, cl_command_queue queue, int img, cl_mem out, const conv_filter *filter,
+                                 cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+    int status;
+    const int radius = filter->size / 2;
+    cl_kernel kernel = conv->img_kernel[k];
+
+    status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &conv->img[img]);
+    checkError(status, "Failed to set convolve_image input img arg");
+    status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+    checkError(status, "Failed to set convolve_image output img arg");
+    status = clSetKernelArg(kernel, 6, sizeof(int), &radius);
+    checkError(status, "Failed to set convolve_image radius arg");
+    status = clSetKernelArg(kernel, 7, sizeof(cl_mem), &filter->weights_cl);
+    checkError(status, "Failed to set convolve_image weights arg");
+
+    return clEnqueueNDRangeKernel(queue, kernel, 2, NULL, conv->global_size, tune_local(conv->tune, "convolve_image"),
+                                  num_events, wait_list, event);
+}
+
+// enqueues one convolution of in into out with kernel instance k
+static cl_int conv_enqueue_instance(conv_stage *conv, int k, cl_command_queue queue, cl_mem in, cl_mem out, const conv_filter *filter,
+                                    cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+    int status;
+
+    if (conv->impl == CONV_IMAGE) {
+        cl_event upload_event;
+        status = conv_enqueue_upload(conv, k, queue, in, num_events, wait_list, &upload_event);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = conv_enqueue_image(conv, k, queue, k, out, filter, 1, &upload_event, event);
+        clReleaseEvent(upload_event);
+        return status;
+    }
+
+    if (conv->impl == CONV_INT && filter->int_shift >= 0) {
+        const int radius = filter->size / 2;
+        cl_kernel kernel = conv->int_kernel[filter->int_short ? 0 : 1][k];
+
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+        checkError(status, "Failed to set convolve_int input img arg");
+        status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+        checkError(status, "Failed to set convolve_int output img arg");
+        status = clSetKernelArg(kernel, 6, sizeof(int), &radius);
+        checkError(status, "Failed to set convolve_int radius arg");
+        status = clSetKernelArg(kernel, 7, sizeof(int), &filter->int_shift);
+        checkError(status, "Failed to set convolve_int shift arg");
+        status = clSetKernelArg(kernel, 8, sizeof(cl_mem), &filter->iweights_cl);
+        checkError(status, "Failed to set convolve_int weights arg");
+
+        return clEnqueueNDRangeKernel(queue, kernel, 3, NULL, conv->int_global_size, tune_local(conv->tune, "convolve_int"),
+                                      num_events, wait_list, event);
+    }
+
+    if (conv->impl == CONV_JIT) {
+        cl_kernel kernel = jit_cache_get(&conv->jit, conv->context, conv->device, filter->weights, filter->size, conv->layout.border > 0);
+
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+        checkError(status, "Failed to set convolve_jit input img arg");
+        status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+        checkError(status, "Failed to set convolve_jit output img arg");
+        frame_set_args(kernel, 2, &conv->layout, "convolve_jit");
+
+        return clEnqueueNDRangeKernel(queue, kernel, conv->dim, NULL, conv->global_size, tune_local(conv->tune, "convolve_jit"),
+                                      num_events, wait_list, event);
+    }
+
+    if (conv->impl == CONV_SEPARABLE && filter->separable) {
+        const int radius = filter->size / 2;
+        const size_t global_size[3] = { (size_t)conv->width, (size_t)conv->height, (size_t)conv->batch };
+        cl_kernel row_kernel = conv->row_kernel[k];
+        cl_event row_event;
+
+        status = clSetKernelArg(row_kernel, 0, sizeof(cl_mem), &in);
+        checkError(status, "Failed to set row_pass input arg");
+        status = clSetKernelArg(row_kernel, 1, sizeof(cl_mem), &conv->tmp[k]);
+        checkError(status, "Failed to set row_pass output arg");
+        status = clSetKernelArg(row_kernel, 6, sizeof(int), &radius);
+        checkError(status, "Failed to set row_pass radius arg");
+        status = clSetKernelArg(row_kernel, 7, sizeof(cl_mem), &filter->row_cl);
+        checkError(status, "Failed to set row_pass weights arg");
+
+        status = clEnqueueNDRangeKernel(queue, row_kernel, 3, NULL, global_size, tune_local(conv->tune, "row_pass"),
+                                        num_events, wait_list, &row_event);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = conv_enqueue_col(conv, k, queue, out, filter, 1, &row_event, event);
+        clReleaseEvent(row_event);
+        return status;
+    }
+
+    if (filter->size != 3) {
+        printf("%dx%d filters need the separable, jit or image convolution, or int when the weights are k/2^n with n up to 16\n", filter->size, filter->size);
+        exit(-1);
+    }
+
+    const bool tiled = conv->impl == CONV_TILED;
+    cl_kernel kernel = conv->kernel[k];
+    status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+    checkError(status, "Failed to set convolve kernel input img arg");
+    status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+    checkError(status, "Failed to set convolve kernel output img arg");
+    status = clSetKernelArg(kernel, 6, sizeof(cl_mem), &filter->weights_cl);
+    checkError(status, "Failed to set convolve kernel weights arg");
+
+    return clEnqueueNDRangeKernel(queue, kernel, conv->dim, NULL, conv->global_size,
+                                  tiled ? conv->local_size : tune_local(conv->tune, "convolve"), num_events, wait_list, event);
+}
+
+// refreshes the border of in before it is convolved, when the frames are
+// padded. the convolution then waits on *pad_event instead of wait_list
+static cl_int conv_pad_input(conv_stage *conv, cl_command_queue queue, cl_mem in,
+                             cl_uint *num_events, const cl_event **wait_list, cl_event *pad_event)
+{
+    *pad_event = NULL;
+    if (conv->layout.border == 0)
+        return CL_SUCCESS;
+
+    cl_int status = frame_pad(&conv->padder, queue, in, *num_events, *wait_list, pad_event);
+    if (status == CL_SUCCESS) {
+        *num_events = 1;
+        *wait_list = pad_event;
+    }
+    return status;
+}
+
+// enqueues one convolution of in into out, same wait list and event arguments as clEnqueueNDRangeKernel
+cl_int conv_enqueue(conv_stage *conv, cl_command_queue queue, cl_mem in, cl_mem out, const conv_filter *filter,
+                    cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+    cl_event pad_event;
+    cl_int status = conv_pad_input(conv, queue, in, &num_events, &wait_list, &pad_event);
+    if (status == CL_SUCCESS)
+        status = conv_enqueue_instance(conv, 0, queue, in, out, filter, num_events, wait_list, event);
+    if (pad_event != NULL)
+        clReleaseEvent(pad_event);
+    return status;
+}
+
+static cl_int conv_enqueue_pair_instances(conv_stage *conv, cl_command_queue queue_a, cl_command_queue queue_b, cl_mem in,
+                                          cl_mem out_a, const conv_filter *filter_a,
+                                          cl_mem out_b, const conv_filter *filter_b,
+                                          cl_uint num_events, const cl_event *wait_list,
+                                          cl_event *event_a, cl_event *event_b)
+{
+    int status;
+
+    // both filters read the one copy of the input
+    if (conv->impl == CONV_IMAGE) {
+        cl_event upload_event;
+        status = conv_enqueue_upload(conv, 0, queue_a, in, num_events, wait_list, &upload_event);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = conv_enqueue_image(conv, 0, queue_a, 0, out_a, filter_a, 1, &upload_event, event_a);
+        if (status == CL_SUCCESS)
+            status = conv_enqueue_image(conv, 1, queue_b, 0, out_b, filter_b, 1, &upload_event, event_b);
+        clReleaseEvent(upload_event);
+        return status;
+    }
+
+    if (conv->impl != CONV_SEPARABLE || !filter_a->separable || !filter_b->separable || filter_a->size != filter_b->size) {
+        status = conv_enqueue_instance(conv, 0, queue_a, in, out_a, filter_a, num_events, wait_list, event_a);
+        if (status != CL_SUCCESS)
+            return status;
+        return conv_enqueue_instance(conv, 1, queue_b, in, out_b, filter_b, num_events, wait_list, event_b);
+    }
+
+    const int radius = filter_a->size / 2;
+    const size_t global_size[3] = { (size_t)conv->width, (size_t)conv->height, (size_t)conv->batch };
+    cl_event row_event;
+
+    status = clSetKernelArg(conv->row2_kernel, 0, sizeof(cl_mem), &in);
+    checkError(status, "Failed to set row_pass2 input arg");
+    status = clSetKernelArg(conv->row2_kernel, 1, sizeof(cl_mem), &conv->tmp[0]);
+    checkError(status, "Failed to set row_pass2 output a arg");
+    status = clSetKernelArg(conv->row2_kernel, 2, sizeof(cl_mem), &conv->tmp[1]);
+    checkError(status, "Failed to set row_pass2 output b arg");
+    status = clSetKernelArg(conv->row2_kernel, 7, sizeof(int), &radius);
+    checkError(status, "Failed to set row_pass2 radius arg");
+    status = clSetKernelArg(conv->row2_kernel, 8, sizeof(cl_mem), &filter_a->row_cl);
+    checkError(status, "Failed to set row_pass2 weights a arg");
+    status = clSetKernelArg(conv->row2_kernel, 9, sizeof(cl_mem), &filter_b->row_cl);
+    checkError(status, "Failed to set row_pass2 weights b arg");
+
+    status = clEnqueueNDRangeKernel(queue_a, conv->row2_kernel, 3, NULL, global_size, tune_local(conv->tune, "row_pass2"),
+                                    num_events, wait_list, &row_event);
+    if (status != CL_SUCCESS)
+        return status;
+
+    status = conv_enqueue_col(conv, 0, queue_a, out_a, filter_a, 1, &row_event, event_a);
+    if (status == CL_SUCCESS)
+        status = conv_enqueue_col(conv, 1, queue_b, out_b, filter_b, 1, &row_event, event_b);
+    clReleaseEvent(row_event);
+    return status;
+}
+
+// convolves in with two filters, e.g. sobel x and y. with the separable
+// kernels both row passes share one read of the input, and a padded input has
+// its border refreshed once for both. the two halves only depend on wait_list
+// and use their own kernel instances and scratch, so queue_b can be a second
+// queue, or the same out-of-order queue, to let the device run them side by side
+cl_int conv_enqueue_pair(conv_stage *conv, cl_command_queue queue_a, cl_command_queue queue_b, cl_mem in,
+                         cl_mem out_a, const conv_filter *filter_a,
+                         cl_mem out_b, const conv_filter *filter_b,
+                         cl_uint num_events, const cl_event *wait_list,
+                         cl_event *event_a, cl_event *event_b)
+{
+    cl_event pad_event;
+    cl_int status = conv_pad_input(conv, queue_a, in, &num_events, &wait_list, &pad_event);
+    if (status == CL_SUCCESS)
+        status = conv_enqueue_pair_instances(conv, queue_a, queue_b, in, out_a, filter_a, out_b, filter_b,
+                                             num_events, wait_list, event_a, event_b);
+    if (pad_event != NULL)
+        clReleaseEvent(pad_event);
+    return status;
+}
+
+// builds anything filter specific ahead of time so it doesn't end up in the frame timings
+void conv_prepare(conv_stage *conv, const conv_filter *filter)
+{
+    if (conv->impl == CONV_JIT)
+        jit_cache_get(&conv->jit, conv->context, conv->device, filter->weights, filter->size, conv->layout.border > 0);
+}
+
+void conv_release(conv_stage *conv)
+{
+    frame_padder_release(&conv->padder);
+    if (conv->program != NULL) {
+        clReleaseKernel(conv->kernel[0]);
+        clReleaseKernel(conv->kernel[1]);
+        clReleaseProgram(conv->program);
+    }
+    jit_cache_release(&conv->jit);
+    if (conv->sep_program != NULL) {
+        for (int k = 0; k < 2; k++) {
+            clReleaseKernel(conv->row_kernel[k]);
+            clReleaseKernel(conv->col_kernel[k]);
+            clReleaseMemObject(conv->tmp[k]);
+        }
+        clReleaseKernel(conv->row2_kernel);
+        clReleaseProgram(conv->sep_program);
+    }
+    if (conv->img_program != NULL) {
+        for (int k = 0; k < 2; k++) {
+            clReleaseKernel(conv->img_kernel[k]);
+            clReleaseMemObject(conv->img[k]);
+        }
+        clReleaseProgram(conv->img_program);
+    }
+    if (conv->int_program[0] != NULL) {
+        for (int a = 0; a < 2; a++) {
+            clReleaseKernel(conv->int_kernel[a][0]);
+            clReleaseKernel(conv->int_kernel[a][1]);
+            clReleaseProgram(conv->int_program[a]);
+        }
+    }
+}
+
+#endif // CONVOLUTION_H
@@ -2,15 +2,22 @@
 #define HALF_SIZE 1
 
 // this kernel only works for 3x3 kernels because there was
-// a massive speedup by hardcoding the kernel sizes
+// a massive speedup by hardcoding the kernel sizes. the taps outside the
+// frame land on the border of the padded layout, with the packed one they
+// read the neighbouring rows. a batch is packed and one long range
 __kernel void convolve(__global const unsigned char *in,
                        __global unsigned char *out,
-                       const int width, 
-                       __constant float *kern) 
+                       const int width,
+                       const int height,
+                       const int pitch,
+                       const int origin,
+                       __constant float *kern)
 {
     int gid = get_global_id(0);
     int row = gid / width;
     int col = gid % width;
+    in += origin;
+    out += origin;
 
     float res = 0;
     for (int i = -HALF_SIZE; i <= HALF_SIZE; i++) {
@@ -19,7 +26,7 @@ __kernel void convolve(__global const unsigned char *in,
 
             int local_row = row + i;
             int local_col = col + j;
-            int img_idx = local_row * width + local_col;
+            int img_idx = local_row * pitch + local_col;
 
             unsigned char px;
             px = in[img_idx];
@@ -32,6 +39,6 @@ __kernel void convolve(__global const unsigned char *in,
         }
     }
 
-    out[gid] = (unsigned char)res;
+    out[row * pitch + col] = (unsigned char)res;
 }
 
@@ -0,0 +1,32 @@
+__constant sampler_t clamp_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// convolution of any odd size filter reading the frame through the texture
+// path. the sampler clamps reads outside the frame to the edge, so there is
+// no border handling here. the image is CL_UNORM_INT8, read_imagef returns
+// pixel / 255. the image is uploaded from a packed frame, the result goes
+// to out in whatever layout pitch and origin give
+__kernel void convolve_image(__read_only image2d_t in,
+                             __global uchar *out,
+                             const int width,
+                             const int height,
+                             const int pitch,
+                             const int origin,
+                             const int radius,
+                             __constant float *kern)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int size = 2 * radius + 1;
+
+    float res = 0;
+    for (int i = -radius; i <= radius; i++) {
+        for (int j = -radius; j <= radius; j++) {
+            float px = read_imagef(in, clamp_sampler, (int2)(x + j, y + i)).x;
+            res += px * kern[(radius + i) * size + (radius + j)];
+        }
+    }
+
+    // back to 0..255. the small bias keeps exact results like 254.99998 from
+    // truncating down, the buffer kernels truncate too
+    out[origin + y * pitch + x] = convert_uchar_sat(res * 255.0f + 1e-3f);
+}
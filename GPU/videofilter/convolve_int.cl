@@ -0,0 +1,75 @@
+#ifndef VEC
+#define VEC 8
+#endif
+#ifndef ACC
+#define ACC short
+#endif
+
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+#define ACCN CAT(ACC, VEC)
+#define VLOAD CAT(vload, VEC)
+#define VSTORE CAT(vstore, VEC)
+#define CONVERT_ACCN CAT(convert_, ACCN)
+#define CONVERT_UCHARN_SAT CAT(CAT(convert_uchar, VEC), _sat)
+
+// integer convolution for filters whose weights are all kern / 2^shift, like
+// the gaussian (k/16) and scharr. every work-item does VEC adjacent pixels of
+// one row with vector loads and integer math, ACC is short when the sums fit
+// 16 bits. only the work-items at the left and right edge need clamped
+// columns, they do their pixels one at a time. with PADDED the frame has a
+// border of at least radius and room for a whole VEC group past its last
+// pixel, so nothing is clamped and every work-item takes the vector path. the
+// third dimension picks the frame in a batch, which is packed
+__kernel void convolve_int(__global const uchar *in,
+                           __global uchar *out,
+                           const int width,
+                           const int height,
+                           const int pitch,
+                           const int origin,
+                           const int radius,
+                           const int shift,
+                           __constant int *kern)
+{
+    const int x0 = get_global_id(0) * VEC;
+    const int y = get_global_id(1);
+    const int size = 2 * radius + 1;
+    const size_t frame = origin + get_global_id(2) * (size_t)pitch * height;
+    in += frame;
+    out += frame;
+
+    if (x0 >= width || y >= height)
+        return;
+
+#ifndef PADDED
+    if (x0 >= radius && x0 + VEC + radius <= width) {
+#endif
+        ACCN acc = (ACCN)(0);
+        for (int i = -radius; i <= radius; i++) {
+#ifdef PADDED
+            __global const uchar *row = in + (y + i) * pitch + x0;
+#else
+            __global const uchar *row = in + clamp(y + i, 0, height - 1) * pitch + x0;
+#endif
+            for (int j = -radius; j <= radius; j++)
+                acc += CONVERT_ACCN(VLOAD(0, row + j)) * (ACC)kern[(radius + i) * size + radius + j];
+        }
+        // >> floors instead of truncating, which only differs for negative sums and those saturate to 0 anyway.
+        // past the last pixel this writes into the border, which is refreshed before it is read again
+        VSTORE(CONVERT_UCHARN_SAT(acc >> (ACCN)(shift)), 0, out + y * pitch + x0);
+#ifndef PADDED
+        return;
+    }
+
+    for (int p = 0; p < VEC && x0 + p < width; p++) {
+        const int x = x0 + p;
+        ACC acc = 0;
+        for (int i = -radius; i <= radius; i++) {
+            __global const uchar *row = in + clamp(y + i, 0, height - 1) * pitch;
+            for (int j = -radius; j <= radius; j++)
+                acc += row[clamp(x + j, 0, width - 1)] * (ACC)kern[(radius + i) * size + radius + j];
+        }
+        out[y * pitch + x] = convert_uchar_sat(acc >> shift);
+    }
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef TILE_W
+#define TILE_W 16
+#endif
+#ifndef TILE_H
+#define TILE_H 16
+#endif
+
+#define KERN_SIZE 3
+#define HALF_SIZE 1
+#define LOCAL_W (TILE_W + 2 * HALF_SIZE)
+#define LOCAL_H (TILE_H + 2 * HALF_SIZE)
+#define WG_SIZE (TILE_W * TILE_H)
+
+// 2D version of convolve. the work-group first loads its tile plus a one
+// pixel apron into local memory, so every input pixel is read from global
+// memory about once instead of nine times. pixels outside the frame are
+// clamped to the edge, the tiles past the frame reach further out than any
+// border. the third dimension picks the frame in a batch, which is packed
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void convolve_tiled(__global const uchar *in,
+                    __global uchar *out,
+                    const int width,
+                    const int height,
+                    const int pitch,
+                    const int origin,
+                    __constant float *kern)
+{
+    __local uchar tile[LOCAL_W * LOCAL_H];
+
+    const size_t frame = origin + get_global_id(2) * (size_t)pitch * height;
+    in += frame;
+    out += frame;
+
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int lid = get_local_id(1) * TILE_W + get_local_id(0);
+    const int x0 = get_group_id(0) * TILE_W - HALF_SIZE;
+    const int y0 = get_group_id(1) * TILE_H - HALF_SIZE;
+
+    for (int i = lid; i < LOCAL_W * LOCAL_H; i += WG_SIZE) {
+        int gx = clamp(x0 + i % LOCAL_W, 0, width - 1);
+        int gy = clamp(y0 + i / LOCAL_W, 0, height - 1);
+        tile[i] = in[gy * pitch + gx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (x >= width || y >= height)
+        return;
+
+    __local const uchar *p = tile + (get_local_id(1) + HALF_SIZE) * LOCAL_W + get_local_id(0) + HALF_SIZE;
+
+    float res = 0;
+    for (int i = -HALF_SIZE; i <= HALF_SIZE; i++) {
+        for (int j = -HALF_SIZE; j <= HALF_SIZE; j++) {
+            res += p[i * LOCAL_W + j] * kern[(HALF_SIZE + i) * KERN_SIZE + (HALF_SIZE + j)];
+        }
+    }
+
+    // saturate so negative sobel responses become 0 like the opencv version
+    out[y * pitch + x] = convert_uchar_sat(res);
+}
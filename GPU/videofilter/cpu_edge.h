@@ -0,0 +1,278 @@
+#ifndef CPU_EDGE_H
+#define CPU_EDGE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CPU_EDGE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CPU_EDGE_SSE2
+#endif
+
+#define CPU_HALO 4          // three gaussian passes and the gradient, like edge_fused.cl
+#define CPU_STRIP_ROWS 16   // rows filtered at a time, the strip and its apron stay in cache
+#define MAX_CPU_THREADS 16
+
+
+// one band of rows per thread. every band goes through the frame a strip at a
+// time, and every strip runs the whole edge pipeline (gaussian x3, scharr x/y,
+// average, threshold and mask) on a padded copy of its rows before moving on,
+// the same way edge_fused.cl does per tile. the result is the same as the fused
+// kernel's, bit for bit
+struct cpu_edge_pool {
+    int num_threads = 0;
+    int width = 0, height = 0;
+    int thresh = 0, maxval = 0;
+
+    // per thread, (CPU_STRIP_ROWS + 2 * CPU_HALO) rows of (width + 2 * CPU_HALO)
+    std::vector<uint8_t> strip_a[MAX_CPU_THREADS], strip_b[MAX_CPU_THREADS];
+    std::vector<uint16_t> row_sum[MAX_CPU_THREADS];
+
+    // the frame the workers are on and its rows they filter, set by cpu_edge_rows
+    const uint8_t *in = nullptr;
+    uint8_t *out = nullptr;
+    int row_begin = 0, row_end = 0;
+    int generation = 0;     // bumped for every frame
+    int pending = 0;        // workers not done with it
+    bool stop = false;
+    std::mutex lock{};
+    std::condition_variable start{}, done{};
+    std::thread workers[MAX_CPU_THREADS];
+};
+
+// out[c] = r0[c] + 2 * r1[c] + r2[c] for n columns
+static void vertical_121(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2, uint16_t *out, int n)
+{
+    int c = 0;
+#if defined(CPU_EDGE_NEON)
+    for (; c + 8 <= n; c += 8) {
+        uint16x8_t s = vaddl_u8(vld1_u8(r0 + c), vld1_u8(r2 + c));
+        vst1q_u16(out + c, vaddq_u16(s, vshll_n_u8(vld1_u8(r1 + c), 1)));
+    }
+#elif defined(CPU_EDGE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; c + 8 <= n; c += 8) {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r0 + c)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r1 + c)), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(r2 + c)), zero);
+        _mm_storeu_si128((__m128i *)(out + c), _mm_add_epi16(_mm_add_epi16(a, d), _mm_slli_epi16(b, 1)));
+    }
+#endif
+    for (; c < n; c++)
+        out[c] = r0[c] + 2 * r1[c] + r2[c];
+}
+
+// out[c] = (v[c - 1] + 2 * v[c] + v[c + 1]) >> 4 for n columns, v has one more on either side
+static void horizontal_121(const uint16_t *v, uint8_t *out, int n)
+{
+    int c = 0;
+#if defined(CPU_EDGE_NEON)
+    for (; c + 8 <= n; c += 8) {
+        uint16x8_t s = vaddq_u16(vld1q_u16(v + c - 1), vld1q_u16(v + c + 1));
+        s = vaddq_u16(s, vshlq_n_u16(vld1q_u16(v + c), 1));
+        vst1_u8(out + c, vshrn_n_u16(s, 4));
+    }
+#elif defined(CPU_EDGE_SSE2)
+    for (; c + 8 <= n; c += 8) {
+        __m128i s = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(v + c - 1)), _mm_loadu_si128((const __m128i *)(v + c + 1)));
+        s = _mm_add_epi16(s, _mm_slli_epi16(_mm_loadu_si128((const __m128i *)(v + c)), 1));
+        s = _mm_srli_epi16(s, 4);
+        _mm_storel_epi64((__m128i *)(out + c), _mm_packus_epi16(s, s));
+    }
+#endif
+    for (; c < n; c++)
+        out[c] = (uint8_t)((v[c - 1] + 2 * v[c] + v[c + 1]) >> 4);
+}
+
+// scharr x/y of the blurred rows r0..r2 around column c, the saturated average
+// of the two, the inverted threshold and the mask of r1 with it, for n columns
+static void edge_mask_row(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2, uint8_t *out, int n, int thresh, int maxval)
+{
+    int c = 0;
+#if defined(CPU_EDGE_NEON)
+    const uint8x8_t th = vdup_n_u8((uint8_t)thresh);
+    const uint8x8_t mv = vdup_n_u8((uint8_t)maxval);
+    for (; c + 8 <= n; c += 8) {
+        int16x8_t dx0 = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(r0 + c + 1), vld1_u8(r0 + c - 1)));
+        int16x8_t dx1 = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(r1 + c + 1), vld1_u8(r1 + c - 1)));
+        int16x8_t dx2 = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(r2 + c + 1), vld1_u8(r2 + c - 1)));
+        int16x8_t dy0 = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(r2 + c - 1), vld1_u8(r0 + c - 1)));
+        int16x8_t dy1 = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(r2 + c), vld1_u8(r0 + c)));
+        int16x8_t dy2 = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(r2 + c + 1), vld1_u8(r0 + c + 1)));
+        int16x8_t sx = vmlaq_n_s16(vmulq_n_s16(vaddq_s16(dx0, dx2), 3), dx1, 10);
+        int16x8_t sy = vmlaq_n_s16(vmulq_n_s16(vaddq_s16(dy0, dy2), 3), dy1, 10);
+
+        uint8x8_t edge = vadd_u8(vshr_n_u8(vqmovun_s16(sx), 1), vshr_n_u8(vqmovun_s16(sy), 1));
+        uint8x8_t mask = vbic_u8(mv, vcgt_u8(edge, th));
+        vst1_u8(out + c, vand_u8(vld1_u8(r1 + c), mask));
+    }
+#elif defined(CPU_EDGE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i three = _mm_set1_epi16(3);
+    const __m128i ten = _mm_set1_epi16(10);
+    const __m128i th = _mm_set1_epi16((short)thresh);
+    const __m128i mv = _mm_set1_epi16((short)maxval);
+#define LOAD8(p) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), zero)
+    for (; c + 8 <= n; c += 8) {
+        __m128i dx0 = _mm_sub_epi16(LOAD8(r0 + c + 1), LOAD8(r0 + c - 1));
+        __m128i dx1 = _mm_sub_epi16(LOAD8(r1 + c + 1), LOAD8(r1 + c - 1));
+        __m128i dx2 = _mm_sub_epi16(LOAD8(r2 + c + 1), LOAD8(r2 + c - 1));
+        __m128i dy0 = _mm_sub_epi16(LOAD8(r2 + c - 1), LOAD8(r0 + c - 1));
+        __m128i dy1 = _mm_sub_epi16(LOAD8(r2 + c), LOAD8(r0 + c));
+        __m128i dy2 = _mm_sub_epi16(LOAD8(r2 + c + 1), LOAD8(r0 + c + 1));
+        __m128i sx = _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(dx0, dx2), three), _mm_mullo_epi16(dx1, ten));
+        __m128i sy = _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(dy0, dy2), three), _mm_mullo_epi16(dy1, ten));
+
+        // saturate to 0..255 through the unsigned pack, then back to 16 bit lanes
+        sx = _mm_unpacklo_epi8(_mm_packus_epi16(sx, sx), zero);
+        sy = _mm_unpacklo_epi8(_mm_packus_epi16(sy, sy), zero);
+        __m128i edge = _mm_add_epi16(_mm_srli_epi16(sx, 1), _mm_srli_epi16(sy, 1));
+        __m128i mask = _mm_andnot_si128(_mm_cmpgt_epi16(edge, th), mv);
+        __m128i res = _mm_and_si128(LOAD8(r1 + c), mask);
+        _mm_storel_epi64((__m128i *)(out + c), _mm_packus_epi16(res, res));
+    }
+#undef LOAD8
+#endif
+    for (; c < n; c++) {
+        int sx = 3 * (r0[c + 1] - r0[c - 1]) + 10 * (r1[c + 1] - r1[c - 1]) + 3 * (r2[c + 1] - r2[c - 1]);
+        int sy = 3 * (r2[c - 1] - r0[c - 1]) + 10 * (r2[c] - r0[c]) + 3 * (r2[c + 1] - r0[c + 1]);
+        uint8_t ex = (uint8_t)std::min(std::max(sx, 0), 255);
+        uint8_t ey = (uint8_t)std::min(std::max(sy, 0), 255);
+        uint8_t edge = ex / 2 + ey / 2;
+        out[c] = r1[c] & (edge > thresh ? 0 : maxval);
+    }
+}
+
+// one gaussian pass over the strip, skipping border pixels on every side
+static void gaussian_strip(const uint8_t *src, uint8_t *dst, uint16_t *row_sum, int w, int h, int border)
+{
+    for (int r = border; r < h - border; r++) {
+        const uint8_t *p = src + r * w;
+        vertical_121(p - w + border - 1, p + border - 1, p + w + border - 1, row_sum, w - 2 * border + 2);
+        horizontal_121(row_sum + 1, dst + r * w + border, w - 2 * border);
+    }
+}
+
+// rows y0..y1 of the frame, through one strip after the other
+static void cpu_edge_band(cpu_edge_pool *pool, int t, int y0, int y1)
+{
+    const int width = pool->width;
+    const int height = pool->height;
+    const int w = width + 2 * CPU_HALO;
+    uint8_t *a = pool->strip_a[t].data();
+    uint8_t *b = pool->strip_b[t].data();
+    uint16_t *row_sum = pool->row_sum[t].data();
+
+    for (int s0 = y0; s0 < y1; s0 += CPU_STRIP_ROWS) {
+        const int rows = std::min(CPU_STRIP_ROWS, y1 - s0);
+        const int h = rows + 2 * CPU_HALO;
+
+        // the strip with its apron, clamped to the frame like the fused kernel does
+        for (int r = 0; r < h; r++) {
+            const uint8_t *src = pool->in + std::min(std::max(s0 - CPU_HALO + r, 0), height - 1) * width;
+            uint8_t *dst = a + r * w;
+            memset(dst, src[0], CPU_HALO);
+            memcpy(dst + CPU_HALO, src, width);
+            memset(dst + CPU_HALO + width, src[width - 1], CPU_HALO);
+        }
+
+        gaussian_strip(a, b, row_sum, w, h, 1);
+        gaussian_strip(b, a, row_sum, w, h, 2);
+        gaussian_strip(a, b, row_sum, w, h, 3);
+
+        for (int r = 0; r < rows; r++) {
+            const uint8_t *p = b + (r + CPU_HALO) * w + CPU_HALO;
+            edge_mask_row(p - w, p, p + w, pool->out + (s0 + r) * width, width, pool->thresh, pool->maxval);
+        }
+    }
+}
+
+static void cpu_edge_worker(cpu_edge_pool *pool, int t)
+{
+    int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->start.wait(guard, [pool, seen] { return pool->stop || pool->generation != seen; });
+            if (pool->stop)
+                return;
+            seen = pool->generation;
+        }
+
+        const int rows = pool->row_end - pool->row_begin;
+        cpu_edge_band(pool, t, pool->row_begin + rows * t / pool->num_threads, pool->row_begin + rows * (t + 1) / pool->num_threads);
+
+        std::lock_guard<std::mutex> guard(pool->lock);
+        if (--pool->pending == 0)
+            pool->done.notify_one();
+    }
+}
+
+// starts num_threads workers for width x height frames, 0 for one per core
+void cpu_edge_init(cpu_edge_pool *pool, int num_threads, int width, int height, int thresh, int maxval)
+{
+    if (num_threads <= 0)
+        num_threads = std::thread::hardware_concurrency();
+    pool->num_threads = std::max(1, std::min(num_threads, MAX_CPU_THREADS));
+    pool->width = width;
+    pool->height = height;
+    pool->thresh = thresh;
+    pool->maxval = maxval;
+    pool->in = NULL;
+    pool->out = NULL;
+    pool->row_begin = pool->row_end = 0;
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->stop = false;
+
+    const size_t strip = (size_t)(CPU_STRIP_ROWS + 2 * CPU_HALO) * (width + 2 * CPU_HALO);
+    for (int t = 0; t < pool->num_threads; t++) {
+        pool->strip_a[t].assign(strip, 0);
+        pool->strip_b[t].assign(strip, 0);
+        pool->row_sum[t].assign(width + 2 * CPU_HALO + 2, 0);
+        pool->workers[t] = std::thread(cpu_edge_worker, pool, t);
+    }
+}
+
+// the whole pipeline on the cpu for rows y0..y1 of the frame, split into one
+// band per thread. the masked rows end up in out like with the fused kernel,
+// in only has to hold them and CPU_HALO rows on either side. blocks until
+// every band is done
+void cpu_edge_rows(cpu_edge_pool *pool, const unsigned char *in, unsigned char *out, int y0, int y1)
+{
+    std::unique_lock<std::mutex> guard(pool->lock);
+    pool->in = in;
+    pool->out = out;
+    pool->row_begin = y0;
+    pool->row_end = y1;
+    pool->pending = pool->num_threads;
+    pool->generation++;
+    pool->start.notify_all();
+    pool->done.wait(guard, [pool] { return pool->pending == 0; });
+}
+
+void cpu_edge_fused(cpu_edge_pool *pool, const unsigned char *in, unsigned char *out)
+{
+    cpu_edge_rows(pool, in, out, 0, pool->height);
+}
+
+void cpu_edge_release(cpu_edge_pool *pool)
+{
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stop = true;
+    }
+    pool->start.notify_all();
+    for (int t = 0; t < pool->num_threads; t++)
+        pool->workers[t].join();
+}
+
+#endif // CPU_EDGE_H
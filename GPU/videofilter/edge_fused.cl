@@ -0,0 +1,155 @@
+#ifndef TILE_W
+#define TILE_W 16
+#endif
+#ifndef TILE_H
+#define TILE_H 16
+#endif
+
+// three gaussian passes and one sobel pass each need one pixel of apron
+#define HALO 4
+#define LOCAL_W (TILE_W + 2 * HALO)
+#define LOCAL_H (TILE_H + 2 * HALO)
+#define WG_SIZE (TILE_W * TILE_H)
+
+// 1-2-1 x 1-2-1 gaussian on the local tile. every pass shrinks the valid
+// region by one pixel, so pass n only computes pixels at least n from the edge
+void gaussian_pass(__local const uchar *src, __local uchar *dst, const int border, const int lid)
+{
+    const int w = LOCAL_W - 2 * border;
+    const int h = LOCAL_H - 2 * border;
+
+    for (int i = lid; i < w * h; i += WG_SIZE) {
+        int row = i / w + border;
+        int col = i % w + border;
+        __local const uchar *p = src + row * LOCAL_W + col;
+
+        // the weights are k/16, so the integer sum shifted down gives the
+        // same result as the float version in convolve.cl
+        int res = p[-LOCAL_W - 1] + 2 * p[-LOCAL_W] + p[-LOCAL_W + 1]
+                + 2 * p[-1]       + 4 * p[0]        + 2 * p[1]
+                + p[LOCAL_W - 1]  + 2 * p[LOCAL_W]  + p[LOCAL_W + 1];
+
+        dst[row * LOCAL_W + col] = (uchar)(res >> 4);
+    }
+}
+
+#ifdef INCREMENTAL
+// one work-group per tile. the tile is marked dirty when the sum of absolute
+// differences between in and ref, the frame it was last filtered from, is
+// above min_sad, and then becomes the new ref. a negative min_sad marks all
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void tile_changes(__global const uchar *in,
+                  __global uchar *ref,
+                  __global uchar *dirty,
+                  const int width,
+                  const int height,
+                  const int pitch,
+                  const int origin,
+                  const int min_sad)
+{
+    __local int sad;
+
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int idx = origin + y * pitch + x;
+    const int lid = get_local_id(1) * TILE_W + get_local_id(0);
+    const bool inside = x < width && y < height;
+
+    if (lid == 0)
+        sad = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uchar px = 0;
+    if (inside) {
+        px = in[idx];
+        int d = abs_diff(px, ref[idx]);
+        if (d != 0)
+            atomic_add(&sad, d);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const bool changed = sad > min_sad;
+    if (changed && inside)
+        ref[idx] = px;
+    if (lid == 0)
+        dirty[get_group_id(1) * get_num_groups(0) + get_group_id(0)] = changed;
+}
+#endif
+
+// does the whole edge pipeline (gaussian x3, sobel x/y, average, threshold
+// and mask) for one tile, so no intermediate frame ever goes to global memory.
+// pixels outside the frame are clamped to the edge when the tile is loaded,
+// the tiles past the frame reach further out than any border.
+// with INCREMENTAL only the tiles next to a dirty one are filtered, the others
+// keep what out already has from an earlier frame
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void edge_fused(__global const uchar *in,
+                __global uchar *out,
+                const int width,
+                const int height,
+                const int pitch,
+                const int origin,
+                const int thresh,
+                const int maxval
+#ifdef INCREMENTAL
+                , __global const uchar *dirty
+#endif
+                )
+{
+    __local uchar buf_a[LOCAL_W * LOCAL_H];
+    __local uchar buf_b[LOCAL_W * LOCAL_H];
+
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int lid = get_local_id(1) * TILE_W + get_local_id(0);
+    const int x0 = get_group_id(0) * TILE_W - HALO;
+    const int y0 = get_group_id(1) * TILE_H - HALO;
+
+#ifdef INCREMENTAL
+    // the apron reaches HALO pixels into the neighbouring tiles, which is at
+    // most one tile as long as the tiles are at least HALO wide and high. the
+    // whole work-group takes the same branch, so returning before the barriers is fine
+    const int tiles_x = get_num_groups(0);
+    const int tiles_y = get_num_groups(1);
+    const int tx = get_group_id(0);
+    const int ty = get_group_id(1);
+    bool stale = false;
+    for (int j = max(ty - 1, 0); j <= min(ty + 1, tiles_y - 1); j++) {
+        for (int i = max(tx - 1, 0); i <= min(tx + 1, tiles_x - 1); i++)
+            stale = stale || dirty[j * tiles_x + i];
+    }
+    if (!stale)
+        return;
+#endif
+
+    // load tile and apron
+    for (int i = lid; i < LOCAL_W * LOCAL_H; i += WG_SIZE) {
+        int gx = clamp(x0 + i % LOCAL_W, 0, width - 1);
+        int gy = clamp(y0 + i / LOCAL_W, 0, height - 1);
+        buf_a[i] = in[origin + gy * pitch + gx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    gaussian_pass(buf_a, buf_b, 1, lid);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    gaussian_pass(buf_b, buf_a, 2, lid);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    gaussian_pass(buf_a, buf_b, 3, lid);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (x >= width || y >= height)
+        return;
+
+    __local const uchar *p = buf_b + (get_local_id(1) + HALO) * LOCAL_W + get_local_id(0) + HALO;
+
+    // same scharr weights as sobel_x_kern and sobel_y_kern in videofilter.cpp
+    int sx = -3 * p[-LOCAL_W - 1] + 3 * p[-LOCAL_W + 1]
+            - 10 * p[-1]          + 10 * p[1]
+            - 3 * p[LOCAL_W - 1]  + 3 * p[LOCAL_W + 1];
+    int sy = -3 * p[-LOCAL_W - 1] - 10 * p[-LOCAL_W] - 3 * p[-LOCAL_W + 1]
+            + 3 * p[LOCAL_W - 1]  + 10 * p[LOCAL_W]  + 3 * p[LOCAL_W + 1];
+
+    uchar edge = convert_uchar_sat(sx) / 2 + convert_uchar_sat(sy) / 2;
+    uchar mask = edge > thresh ? 0 : (uchar)maxval;
+    out[origin + y * pitch + x] = p[0] & mask;
+}
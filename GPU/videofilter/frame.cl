@@ -0,0 +1,31 @@
+// refreshes the replicated border of a padded frame: every pixel of the ring
+// around the width x height frame at buf + origin gets the value of the
+// nearest pixel inside it. one work-item per ring pixel, the bands above and
+// below the frame (corners included) first and then the two sides. the ring
+// pixels only read frame pixels, so the order doesn't matter
+__kernel void pad_border(__global uchar *buf,
+                         const int width,
+                         const int height,
+                         const int pitch,
+                         const int origin,
+                         const int border)
+{
+    const int i = get_global_id(0);
+    const int band_w = width + 2 * border;
+    const int bands = 2 * border * band_w;
+    int x, y;
+
+    if (i < bands) {
+        const int row = i / band_w;
+        x = i % band_w - border;
+        y = row < border ? row - border : height + row - border;
+    } else {
+        const int j = i - bands;
+        const int col = j % (2 * border);
+        x = col < border ? col - border : width + col - border;
+        y = j / (2 * border);
+    }
+
+    buf += origin;
+    buf[y * pitch + x] = buf[clamp(y, 0, height - 1) * pitch + clamp(x, 0, width - 1)];
+}
@@ -0,0 +1,121 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdio.h>
+#include <CL/cl.h>
+#include "opencv2/opencv.hpp"
+
+#include "helpers.h"
+
+#define FRAME_VEC 16    // widest vector the kernels load, uchar16
+
+
+// where the pixels of a frame are in its buffer. pixel (x, y) is at
+// origin + y * pitch + x. the packed layout is width x height with nothing
+// around it. the padded one has a ring of border pixels around the frame
+// that copy the nearest pixel inside, so filters up to that radius read
+// outside the frame without clamping, and starts every row on the device's
+// base address alignment, so the rows line up with its cache lines and
+// vector loads at multiples of FRAME_VEC are aligned
+struct frame_layout {
+    int width, height;
+    int border;     // 0 for the packed layout
+    int pitch;      // bytes from one row to the next
+    int origin;     // offset of pixel (0, 0)
+    size_t bytes;   // size of the buffer for one frame
+};
+
+static int round_up(int x, int multiple)
+{
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+// packed when border is 0. the padded rows leave room for a whole FRAME_VEC
+// group past the last pixel plus the border, so the vector kernels never
+// need a scalar tail
+void frame_layout_init(frame_layout *l, cl_device_id device, int width, int height, int border)
+{
+    l->width = width;
+    l->height = height;
+    l->border = border;
+    if (border == 0) {
+        l->pitch = width;
+        l->origin = 0;
+        l->bytes = (size_t)width * height;
+        return;
+    }
+
+    // CL_DEVICE_MEM_BASE_ADDR_ALIGN is in bits
+    cl_uint align_bits = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, NULL);
+    const int align = (int)align_bits / 8 > FRAME_VEC ? (int)align_bits / 8 : FRAME_VEC;
+
+    const int left = round_up(border, align);
+    l->pitch = round_up(left + round_up(width, FRAME_VEC) + border, align);
+    l->origin = border * l->pitch + left;
+    l->bytes = (size_t)(height + 2 * border) * l->pitch;
+}
+
+// the frame in buf as a Mat, for the stages on the host and the output
+cv::Mat frame_mat(const frame_layout *l, unsigned char *buf)
+{
+    return cv::Mat(cv::Size(l->width, l->height), CV_8U, buf + l->origin, l->pitch);
+}
+
+// sets the width, height, pitch and origin args of a frame kernel, which
+// come in that order from arg `first` on
+void frame_set_args(cl_kernel kernel, cl_uint first, const frame_layout *l, const char *name)
+{
+    char msg[128];
+    const int args[4] = { l->width, l->height, l->pitch, l->origin };
+    for (cl_uint i = 0; i < 4; i++) {
+        int status = clSetKernelArg(kernel, first + i, sizeof(int), &args[i]);
+        snprintf(msg, sizeof(msg), "Failed to set layout args in %s kernel", name);
+        checkError(status, msg);
+    }
+}
+
+// refreshes the border of padded frames on the device, see frame.cl
+struct frame_padder {
+    cl_program program;     // NULL for the packed layout, which has no border
+    cl_kernel kernel;
+    size_t ring;            // pixels around the frame
+};
+
+void frame_padder_init(frame_padder *p, cl_context context, cl_device_id device, const frame_layout *l)
+{
+    int status;
+    p->program = NULL;
+    p->kernel = NULL;
+    p->ring = 0;
+    if (l->border == 0)
+        return;
+
+    p->program = build_program(context, device, "frame.cl", NULL);
+    p->kernel = clCreateKernel(p->program, "pad_border", &status);
+    checkError(status, "Failed to create pad border kernel");
+    frame_set_args(p->kernel, 1, l, "pad border");
+    status = clSetKernelArg(p->kernel, 5, sizeof(int), &l->border);
+    checkError(status, "Failed to set border param in pad border kernel");
+    p->ring = 2 * (size_t)l->border * (l->width + 2 * l->border) + 2 * (size_t)l->border * l->height;
+}
+
+// replicates the edge of the frame in buf into its border, same wait list and
+// event arguments as clEnqueueNDRangeKernel
+cl_int frame_pad(frame_padder *p, cl_command_queue queue, cl_mem buf,
+                 cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+    int status = clSetKernelArg(p->kernel, 0, sizeof(cl_mem), &buf);
+    checkError(status, "Failed to set buf param in pad border kernel");
+    return clEnqueueNDRangeKernel(queue, p->kernel, 1, NULL, &p->ring, NULL, num_events, wait_list, event);
+}
+
+void frame_padder_release(frame_padder *p)
+{
+    if (p->program == NULL)
+        return;
+    clReleaseKernel(p->kernel);
+    clReleaseProgram(p->program);
+}
+
+#endif // FRAME_H
@@ -7,6 +7,8 @@
 #include <CL/cl_ext.h>
 #include <iostream>
 
+#include "program_cache.h"
+#include "kernels.h"
 
 using namespace std;
 
@@ -96,37 +98,35 @@ void print_clbuild_errors(cl_program program,cl_device_id device)
     exit(1);
 }
 
-unsigned char **read_file(const char *name) {
-    size_t size;
-    unsigned char **output=(unsigned char **)malloc(sizeof(unsigned char *));
-    FILE* fp = fopen(name, "rb");
-    if (!fp) {
-        printf("no such file:%s",name);
-        exit(-1);
+// creates and builds a program from source, passing options on to the compiler.
+// the binary comes from the program cache when source and options were built
+// for this device and driver before, see program_cache.h
+cl_program build_program_source(cl_context context, cl_device_id device, const char *source, const char *options)
+{
+    cl_program program;
+    int success = program_cache_build(context, device, source, options, &program);
+    if (program == NULL) {
+        printf("Program creation failed\n");
+        exit(EXIT_FAILURE);
     }
+    if(success != CL_SUCCESS) print_clbuild_errors(program,device);
+    return program;
+}
 
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    *output = (unsigned char *)malloc(size);
-    unsigned char **outputstr=(unsigned char **)malloc(sizeof(unsigned char *));
-    *outputstr= (unsigned char *)malloc(size);
-    if (!*output) {
-        fclose(fp);
-        printf("mem allocate failure:%s",name);
-        exit(-1);
+// creates and builds the program of the .cl file name, which is built into
+// the host, see kernels.h. options are passed on to the compiler
+cl_program build_program(cl_context context, cl_device_id device, const char *name, const char *options)
+{
+    cl_program program;
+    int success = build_embedded_program(context, device, name, options, &program);
+    if (program == NULL) {
+        printf("Program creation failed\n");
+        exit(EXIT_FAILURE);
     }
-
-    if(!fread(*output, size, 1, fp)) printf("failed to read file\n");
-    fclose(fp);
-    printf("file size %d\n",size);
-    printf("-------------------------------------------\n");
-    snprintf((char *)*outputstr,size,"%s\n",*output);
-    printf("%s\n",*outputstr);
-    printf("-------------------------------------------\n");
-    return outputstr;
+    if(success != CL_SUCCESS) print_clbuild_errors(program,device);
+    return program;
 }
+
 void callback(const char *buffer, size_t length, size_t final, void *user_data)
 {
     fwrite(buffer, 1, length, stdout);
@@ -0,0 +1,79 @@
+#ifndef HETERO_H
+#define HETERO_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "cpu_edge.h"
+
+
+// splits every frame between the fused kernel, which takes the top rows, and
+// the cpu pool, which takes the rest. both clamp their apron to the whole
+// frame, so the seam needs nothing but the halo rows on the cpu side. the
+// split moves every frame towards the one where both sides take equally long
+struct hetero_split {
+    int width = 0, height = 0;
+    int tile_h = 0;         // the gpu share is whole tile rows
+    int gpu_rows = 0;       // rows 0..gpu_rows go to the gpu, the rest to the cpu
+    double gpu_share = 0;   // unrounded, what gpu_rows comes from
+
+    // the device owns the frame buffers while the kernel runs, so the cpu
+    // reads its rows from and writes them to host copies of full frame size
+    std::vector<unsigned char> cpu_in{}, cpu_out{};
+};
+
+static int hetero_round(const hetero_split *h, double share)
+{
+    // both sides keep at least one tile row, so both keep getting measured.
+    // a frame of one tile row or less all goes to the gpu
+    int rows = (int)(share * h->height / h->tile_h + 0.5) * h->tile_h;
+    const int max_rows = (h->height - 1) / h->tile_h * h->tile_h;
+    rows = rows > max_rows ? max_rows : rows;
+    rows = rows < h->tile_h ? h->tile_h : rows;
+    return rows > h->height ? h->height : rows;
+}
+
+// starts from an even split
+void hetero_init(hetero_split *h, int width, int height, int tile_h)
+{
+    h->width = width;
+    h->height = height;
+    h->tile_h = tile_h;
+    h->gpu_share = 0.5;
+    h->gpu_rows = hetero_round(h, h->gpu_share);
+    h->cpu_in.assign((size_t)width * height, 0);
+    h->cpu_out.assign((size_t)width * height, 0);
+}
+
+// copies the rows the cpu needs out of the frame, before it goes to the device
+void hetero_stage_input(hetero_split *h, const unsigned char *frame)
+{
+    int y0 = h->gpu_rows - CPU_HALO;
+    y0 = y0 < 0 ? 0 : y0;
+    const size_t offset = (size_t)y0 * h->width;
+    memcpy(h->cpu_in.data() + offset, frame + offset, (size_t)h->width * h->height - offset);
+}
+
+// puts the rows the cpu filtered into the mapped result
+void hetero_merge_output(const hetero_split *h, unsigned char *edge)
+{
+    const size_t offset = (size_t)h->gpu_rows * h->width;
+    memcpy(edge + offset, h->cpu_out.data() + offset, (size_t)h->width * h->height - offset);
+}
+
+// moves the split halfway to where the last frame's time per row says both
+// sides would have finished together
+void hetero_balance(hetero_split *h, double gpu_ms, double cpu_ms)
+{
+    const int cpu_rows = h->height - h->gpu_rows;
+    if (gpu_ms <= 0 || cpu_ms <= 0 || cpu_rows <= 0)
+        return;
+    const double gpu_ms_per_row = gpu_ms / h->gpu_rows;
+    const double cpu_ms_per_row = cpu_ms / cpu_rows;
+    const double target = cpu_ms_per_row / (gpu_ms_per_row + cpu_ms_per_row);
+    h->gpu_share += 0.5 * (target - h->gpu_share);
+    h->gpu_rows = hetero_round(h, h->gpu_share);
+}
+
+#endif // HETERO_H
@@ -0,0 +1,442 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convolution.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "streams.h"
+#include "source.h"
+#include "sink.h"
+#include "cpu_edge.h"
+
+
+struct options {
+    const char *input;  // video to filter, the first of inputs
+    const char *inputs[MAX_STREAMS];    // more than one are filtered as concurrent streams
+    int num_inputs;
+    int raw_width;  // frame size of headerless raw inputs, .gray, .y8 and .yuv
+    int raw_height;
+    const char *output; // filtered video
+    sink_kind sink;     // how output is written
+    int frames;     // frames that are measured
+    int warmup;     // frames filtered before measuring starts
+    bool show;      // imshow every frame, off with --headless
+    const char *summary;    // a json line with the results is appended here, "-" for stdout
+    const char *profile;    // device timestamp percentiles are written here, NULL when not profiling
+    const char *tune_file;  // tuned launch parameters, loaded at startup
+    bool tune;      // benchmark the kernels first and write the winners to tune_file
+
+    // stages done with opencv on the host instead of on the gpu
+    bool cpu_gauss, cpu_sobel, cpu_avg, cpu_thresh;
+    bool cpu_fused;     // all of them in one pass over row bands with simd, instead of opencv
+    int cpu_threads;    // threads for cpu_fused and hetero, 0 for one per core
+    bool hetero;    // split every frame between the fused kernel and the cpu pool
+
+    bool fused;     // run the whole pipeline as the single edge_fused kernel
+    bool otsu;      // pick the threshold from the histogram of every frame instead of the fixed one
+    bool canny;     // edges from gpu canny instead of the sobel average and a fixed threshold
+    float canny_low, canny_high;    // hysteresis thresholds on the gradient magnitude
+    int canny_passes;   // hysteresis passes, each carries an edge one tile further
+    int incremental;    // with fused, only refilter tiles whose mean absolute change is above this, -1 for all tiles
+    conv_impl conv; // kernel used for the gaussian and sobel stages
+    int tile_w;     // work-group size used by the tiled kernels
+    int tile_h;
+    bool chained;   // enqueue the whole frame with event dependencies and sync once
+    concurrency concurrent; // lets sobel x and y run at the same time, needs --chained or --pipeline
+    bool pipeline;  // decode, filter and encode on separate threads
+    int slots;      // frames in flight with --pipeline
+    int batch;      // frames filtered per launch
+    bool gpu_gray;  // decode into a bgr buffer and convert to gray on the gpu
+    bool gray_fused;    // the gpu conversion also does the first gaussian pass
+    int blur_size;  // gaussian filter size, anything but 3 needs a convolution that isn't fixed to 3x3
+    bool padded;    // frames have aligned rows and a replicated border the filters read without clamping
+};
+
+void print_usage(const char *prog)
+{
+    printf("usage: %s [options]\n", prog);
+    printf("  --input PATH     video to filter (default ./bourne.mp4). give it several times to filter\n");
+    printf("                   the videos as concurrent streams with --pipeline, the outputs are then\n");
+    printf("                   numbered like output_0.avi\n");
+    printf("  --size WxH       frame size of headerless raw inputs. .y4m, .gray/.y8 (8 bit luma) and .yuv\n");
+    printf("                   (8 bit 4:2:0) inputs are mmapped and their luma copied straight into the\n");
+    printf("                   frame buffers instead of being decoded\n");
+    printf("  --output PATH    where the filtered video is written (default ./output.avi)\n");
+    printf("  --sink KIND      how the output is written: mjpg, y4m (mono), gray (raw 8 bit frames) or null\n");
+    printf("                   for none at all (default from the output extension, .y4m, .gray/.y8, else mjpg)\n");
+    printf("  --frames N       number of frames to measure (default 299)\n");
+    printf("  --warmup N       frames to filter before measuring starts (default 0)\n");
+    printf("  --headless       don't show the frames\n");
+    printf("  --summary PATH   append the results as one json line to PATH, - for stdout\n");
+    printf("  --profile PATH   time every kernel, map and unmap on the device and write percentiles of\n");
+    printf("                   their queue, submit and execution times to PATH, json if it ends in .json,\n");
+    printf("                   otherwise csv, - for stdout\n");
+    printf("  --tune           first time the launch sizes and vector widths of the kernels this run uses on\n");
+    printf("                   this device and frame size, and save the fastest to the tune file\n");
+    printf("  --tune-file PATH where tuned launch parameters are kept and loaded from at startup\n");
+    printf("                   (default %s)\n", TUNE_FILE);
+    printf("  --cpu STAGES     comma separated stages to run on the cpu with opencv: gauss, sobel, avg, thresh,\n");
+    printf("                   all or none (default none). fused runs the whole pipeline natively instead, on\n");
+    printf("                   bands of rows over a thread pool with neon/sse, giving the same frame as --fused\n");
+    printf("  --threads N      threads for --cpu fused and --hetero (default 0, one per core)\n");
+    printf("  --hetero         with --fused, filter the top rows of every frame on the gpu and the rest on the\n");
+    printf("                   cpu like --cpu fused at the same time, moving the split so both take as long\n");
+    printf("  --fused          run gaussian, sobel, average, threshold and mask as one kernel\n");
+    printf("  --otsu           pick the threshold for every frame with otsu's method on its edge histogram,\n");
+    printf("                   on the gpu or with opencv for --cpu thresh, instead of the fixed 80\n");
+    printf("  --canny LOW,HIGH replace the sobel average and fixed threshold with canny edges on the gpu, LOW and\n");
+    printf("                   HIGH are the hysteresis thresholds in gray levels per pixel (e.g. 15,40)\n");
+    printf("  --canny-passes N hysteresis passes, each follows the edges one tile further (default 4)\n");
+    printf("  --incremental N  with --fused, only filter the tiles (and their neighbours) whose mean absolute\n");
+    printf("                   difference to the frame they were last filtered from is above N, the others\n");
+    printf("                   keep their last result. 0 refilters any change\n");
+    printf("  --conv IMPL      convolution kernel for the gaussian and sobel stages: naive, tiled, separable, jit, image, int\n");
+    printf("  --blur N         size of the gaussian filter, odd (default 3, larger needs --conv separable, jit, image or int,\n");
+    printf("                   int up to %d)\n", INT_MAX_BLUR);
+    printf("  --tile WxH       work-group size of the tiled kernels (default 16x16)\n");
+    printf("  --padded         lay the frames out with rows aligned to the device and a border of the blur\n");
+    printf("                   radius, which the convolutions read instead of clamping\n");
+    printf("  --gray MODE      where frames are converted to gray: host (default), gpu, or gpu-blur\n");
+    printf("                   (gpu fused with the first gaussian pass, needs --blur 3)\n");
+    printf("  --chained        submit each frame as one event chain, stage times from device profiling\n");
+    printf("  --concurrent M   run sobel x and y side by side: ooo (out-of-order queue) or multi (two queues)\n");
+    printf("  --pipeline       overlap decode, gpu filtering and encode/display on separate threads\n");
+    printf("  --slots N        frame buffers in flight with --pipeline (default 3)\n");
+    printf("  --batch N        filter N frames per kernel launch, all stages on the gpu (default 1)\n");
+    printf("  --help           show this message\n");
+}
+
+// sets the cpu_* flags from a list like "gauss,thresh"
+static void parse_cpu_stages(const char *list, options *opts)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", list);
+
+    opts->cpu_gauss = opts->cpu_sobel = opts->cpu_avg = opts->cpu_thresh = false;
+    opts->cpu_fused = false;
+    for (char *name = strtok(buf, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (strcmp(name, "gauss") == 0) {
+            opts->cpu_gauss = true;
+        } else if (strcmp(name, "sobel") == 0) {
+            opts->cpu_sobel = true;
+        } else if (strcmp(name, "avg") == 0) {
+            opts->cpu_avg = true;
+        } else if (strcmp(name, "thresh") == 0) {
+            opts->cpu_thresh = true;
+        } else if (strcmp(name, "fused") == 0) {
+            opts->cpu_fused = true;
+        } else if (strcmp(name, "all") == 0) {
+            opts->cpu_gauss = opts->cpu_sobel = opts->cpu_avg = opts->cpu_thresh = true;
+        } else if (strcmp(name, "none") != 0) {
+            printf("unknown stage: %s\n", name);
+            exit(-1);
+        }
+    }
+}
+
+void parse_options(int argc, char **argv, options *opts)
+{
+    opts->input = "./bourne.mp4";
+    opts->num_inputs = 0;
+    opts->raw_width = 0;
+    opts->raw_height = 0;
+    opts->output = "./output.avi";
+    opts->sink = SINK_AUTO;
+    opts->frames = 299;
+    opts->warmup = 0;
+    opts->show = true;
+    opts->summary = NULL;
+    opts->profile = NULL;
+    opts->tune_file = TUNE_FILE;
+    opts->tune = false;
+    opts->cpu_gauss = opts->cpu_sobel = opts->cpu_avg = opts->cpu_thresh = false;
+    opts->cpu_fused = false;
+    opts->cpu_threads = 0;
+    opts->hetero = false;
+    opts->fused = false;
+    opts->incremental = -1;
+    opts->otsu = false;
+    opts->canny = false;
+    opts->canny_low = 15;
+    opts->canny_high = 40;
+    opts->canny_passes = 4;
+    opts->conv = CONV_NAIVE;
+    opts->tile_w = 16;
+    opts->tile_h = 16;
+    opts->blur_size = 3;
+    opts->padded = false;
+    opts->gpu_gray = false;
+    opts->gray_fused = false;
+    opts->chained = false;
+    opts->concurrent = CONCURRENT_NONE;
+    opts->pipeline = false;
+    opts->slots = 3;
+    opts->batch = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            if (opts->num_inputs == MAX_STREAMS) {
+                printf("at most %d inputs\n", MAX_STREAMS);
+                exit(-1);
+            }
+            opts->inputs[opts->num_inputs++] = argv[++i];
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &opts->raw_width, &opts->raw_height) != 2 || opts->raw_width <= 0 || opts->raw_height <= 0) {
+                printf("invalid frame size: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            opts->output = argv[++i];
+        } else if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "mjpg") == 0) {
+                opts->sink = SINK_MJPG;
+            } else if (strcmp(argv[i], "y4m") == 0) {
+                opts->sink = SINK_Y4M;
+            } else if (strcmp(argv[i], "gray") == 0) {
+                opts->sink = SINK_GRAY;
+            } else if (strcmp(argv[i], "null") == 0) {
+                opts->sink = SINK_NULL;
+            } else {
+                printf("unknown sink: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opts->frames = atoi(argv[++i]);
+            if (opts->frames < 1) {
+                printf("invalid frame count: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            opts->warmup = atoi(argv[++i]);
+            if (opts->warmup < 0) {
+                printf("invalid warm-up frame count: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            opts->show = false;
+        } else if (strcmp(argv[i], "--summary") == 0 && i + 1 < argc) {
+            opts->summary = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            opts->profile = argv[++i];
+        } else if (strcmp(argv[i], "--tune") == 0) {
+            opts->tune = true;
+        } else if (strcmp(argv[i], "--tune-file") == 0 && i + 1 < argc) {
+            opts->tune_file = argv[++i];
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            parse_cpu_stages(argv[++i], opts);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opts->cpu_threads = atoi(argv[++i]);
+            if (opts->cpu_threads < 0 || opts->cpu_threads > MAX_CPU_THREADS) {
+                printf("invalid number of threads: %s, at most %d\n", argv[i], MAX_CPU_THREADS);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--hetero") == 0) {
+            opts->hetero = true;
+        } else if (strcmp(argv[i], "--fused") == 0) {
+            opts->fused = true;
+        } else if (strcmp(argv[i], "--otsu") == 0) {
+            opts->otsu = true;
+        } else if (strcmp(argv[i], "--canny") == 0 && i + 1 < argc) {
+            opts->canny = true;
+            if (sscanf(argv[++i], "%f,%f", &opts->canny_low, &opts->canny_high) != 2 || opts->canny_low < 0 || opts->canny_high < opts->canny_low) {
+                printf("invalid canny thresholds: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--canny-passes") == 0 && i + 1 < argc) {
+            opts->canny_passes = atoi(argv[++i]);
+            if (opts->canny_passes < 1) {
+                printf("invalid number of hysteresis passes: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc) {
+            opts->incremental = atoi(argv[++i]);
+            if (opts->incremental < 0 || opts->incremental > 255) {
+                printf("invalid change threshold: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--conv") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "naive") == 0) {
+                opts->conv = CONV_NAIVE;
+            } else if (strcmp(argv[i], "tiled") == 0) {
+                opts->conv = CONV_TILED;
+            } else if (strcmp(argv[i], "separable") == 0) {
+                opts->conv = CONV_SEPARABLE;
+            } else if (strcmp(argv[i], "jit") == 0) {
+                opts->conv = CONV_JIT;
+            } else if (strcmp(argv[i], "image") == 0) {
+                opts->conv = CONV_IMAGE;
+            } else if (strcmp(argv[i], "int") == 0) {
+                opts->conv = CONV_INT;
+            } else {
+                printf("unknown convolution kernel: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &opts->tile_w, &opts->tile_h) != 2 || opts->tile_w <= 0 || opts->tile_h <= 0) {
+                printf("invalid tile size: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--padded") == 0) {
+            opts->padded = true;
+        } else if (strcmp(argv[i], "--blur") == 0 && i + 1 < argc) {
+            opts->blur_size = atoi(argv[++i]);
+            if (opts->blur_size < 3 || opts->blur_size % 2 == 0 || opts->blur_size > MAX_FILTER_SIZE) {
+                printf("invalid blur size: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--gray") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "host") == 0) {
+                opts->gpu_gray = false;
+                opts->gray_fused = false;
+            } else if (strcmp(argv[i], "gpu") == 0) {
+                opts->gpu_gray = true;
+                opts->gray_fused = false;
+            } else if (strcmp(argv[i], "gpu-blur") == 0) {
+                opts->gpu_gray = true;
+                opts->gray_fused = true;
+            } else {
+                printf("unknown gray conversion: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--chained") == 0) {
+            opts->chained = true;
+        } else if (strcmp(argv[i], "--concurrent") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "ooo") == 0) {
+                opts->concurrent = CONCURRENT_OOO;
+            } else if (strcmp(argv[i], "multi") == 0) {
+                opts->concurrent = CONCURRENT_MULTI;
+            } else {
+                printf("unknown concurrency mode: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            opts->pipeline = true;
+        } else if (strcmp(argv[i], "--slots") == 0 && i + 1 < argc) {
+            opts->slots = atoi(argv[++i]);
+            if (opts->slots < 1 || opts->slots > MAX_SLOTS) {
+                printf("invalid slot count: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            opts->batch = atoi(argv[++i]);
+            if (opts->batch < 1 || opts->batch > MAX_BATCH) {
+                printf("invalid batch size: %s\n", argv[i]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            printf("unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (opts->num_inputs == 0)
+        opts->inputs[opts->num_inputs++] = opts->input;
+    opts->input = opts->inputs[0];
+    if (opts->sink == SINK_AUTO)
+        opts->sink = sink_kind_of(opts->output);
+
+    // the streams share the kernels and scratch buffers, so they only run through the scheduler
+    if (opts->num_inputs > 1 && (!opts->pipeline || opts->show || opts->concurrent != CONCURRENT_NONE || opts->profile != NULL)) {
+        printf("several --input need --pipeline and --headless and can't be used with --concurrent or --profile\n");
+        exit(-1);
+    }
+
+    if (opts->blur_size != 3 && (opts->fused || opts->conv == CONV_NAIVE || opts->conv == CONV_TILED)) {
+        printf("--blur %d needs --conv separable, jit, image or int and can't be used with --fused\n", opts->blur_size);
+        exit(-1);
+    }
+
+    if (opts->conv == CONV_INT && opts->blur_size > INT_MAX_BLUR) {
+        printf("--conv int takes --blur up to %d, larger gaussians need --conv separable, jit or image\n", INT_MAX_BLUR);
+        exit(-1);
+    }
+
+    // the per-stage path relies on queue order, only the event chains are safe to reorder
+    if (opts->concurrent != CONCURRENT_NONE && (opts->fused || (!opts->chained && !opts->pipeline && opts->batch == 1))) {
+        printf("--concurrent needs --chained, --pipeline or --batch and can't be used with --fused\n");
+        exit(-1);
+    }
+
+    const bool any_cpu = opts->cpu_gauss || opts->cpu_sobel || opts->cpu_avg || opts->cpu_thresh || opts->cpu_fused;
+    if (any_cpu && (opts->fused || opts->chained || opts->pipeline)) {
+        printf("--cpu can't be used with --fused, --chained or --pipeline, they run every stage on the gpu\n");
+        exit(-1);
+    }
+
+    if (opts->batch > 1 && (opts->fused || opts->chained || opts->pipeline || any_cpu || opts->gpu_gray || opts->conv == CONV_IMAGE)) {
+        printf("--batch can't be used with --fused, --chained, --pipeline, --cpu, --gray gpu or --conv image\n");
+        exit(-1);
+    }
+
+    if (opts->gpu_gray && !opts->chained && !opts->pipeline) {
+        printf("--gray gpu needs --chained or --pipeline\n");
+        exit(-1);
+    }
+    // raw inputs only have the luma plane read, there is no bgr frame to convert
+    for (int i = 0; i < opts->num_inputs && opts->gpu_gray; i++) {
+        if (raw_format_of(opts->inputs[i]) != RAW_NONE) {
+            printf("--gray gpu can't be used with the raw input %s, it is gray already\n", opts->inputs[i]);
+            exit(-1);
+        }
+    }
+    // the native pipeline only does what the fused kernel does, on the host decoded frame
+    if (opts->cpu_fused && (opts->cpu_gauss || opts->cpu_sobel || opts->cpu_avg || opts->cpu_thresh || opts->otsu || opts->blur_size != 3)) {
+        printf("--cpu fused can't be mixed with other --cpu stages, --otsu or --blur\n");
+        exit(-1);
+    }
+
+    // both halves write into the one edge buffer of the serial loop
+    if (opts->hetero && (!opts->fused || opts->chained || opts->pipeline || opts->batch > 1 || opts->incremental >= 0 || opts->num_inputs > 1)) {
+        printf("--hetero needs --fused and can't be used with --chained, --pipeline, --batch, --incremental or several --input\n");
+        exit(-1);
+    }
+
+    // the batch, the pipeline slots, the streams and the cpu pool keep packed frames,
+    // and an image can't be given a pitch of our own
+    if (opts->padded && (opts->batch > 1 || opts->pipeline || opts->num_inputs > 1 || opts->cpu_fused || opts->hetero || opts->conv == CONV_IMAGE)) {
+        printf("--padded can't be used with --batch, --pipeline, several --input, --cpu fused, --hetero or --conv image\n");
+        exit(-1);
+    }
+
+    // the canny stages only exist in the submit-a-frame chain, which is 2D
+    if (opts->canny && ((!opts->chained && !opts->pipeline) || opts->fused || opts->batch > 1)) {
+        printf("--canny needs --chained or --pipeline and can't be used with --fused or --batch\n");
+        exit(-1);
+    }
+
+    // the fused kernel and canny have thresholds of their own, and a batch would share one histogram
+    if (opts->otsu && (opts->fused || opts->canny || opts->batch > 1)) {
+        printf("--otsu can't be used with --fused, --canny or --batch\n");
+        exit(-1);
+    }
+
+    // the result of a clean tile is whatever edge held after the frame before,
+    // only the serial and chained modes keep filtering into the same edge buffer
+    if (opts->incremental >= 0 && (!opts->fused || opts->pipeline || opts->batch > 1 || opts->num_inputs > 1)) {
+        printf("--incremental needs --fused and can't be used with --pipeline, --batch or several --input\n");
+        exit(-1);
+    }
+    if (opts->incremental >= 0 && (opts->tile_w < 4 || opts->tile_h < 4)) {
+        printf("--incremental needs tiles of at least 4x4, the filter reaches 4 pixels into the neighbours\n");
+        exit(-1);
+    }
+
+    if (opts->gray_fused && (opts->fused || opts->blur_size != 3)) {
+        printf("--gray gpu-blur only works with the 3x3 gaussian and can't be used with --fused\n");
+        exit(-1);
+    }
+}
+
+#endif // OPTIONS_H
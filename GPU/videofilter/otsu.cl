@@ -0,0 +1,88 @@
+#define BINS 256
+
+// 256 bin histogram of the width x height frame at img + origin, with rows
+// pitch apart, so the border and padding of a padded frame aren't counted.
+// every work-item counts up to 16 pixels of one row. every work-group counts
+// into its own histogram in local memory and adds it to hist when done, so
+// there is only one global atomic per bin and work-group. hist has to be
+// zeroed before, the otsu kernel does that for the next frame
+__kernel void histogram(__global const uchar *img,
+                        __global uint *hist,
+                        const int width,
+                        const int height,
+                        const int pitch,
+                        const int origin)
+{
+    __local uint local_hist[BINS];
+    const int lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+    const int lsize = get_local_size(0) * get_local_size(1);
+
+    for (int i = lid; i < BINS; i += lsize)
+        local_hist[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // the last group of a packed row may end past the frame, it goes pixel by pixel
+    const int x0 = get_global_id(0) * 16;
+    __global const uchar *row = img + origin + get_global_id(1) * pitch + x0;
+    uchar px[16];
+    int n = 16;
+    if (x0 + 16 <= width) {
+        vstore16(vload16(0, row), 0, px);
+    } else {
+        n = width - x0;
+        for (int i = 0; i < n; i++)
+            px[i] = row[i];
+    }
+    for (int i = 0; i < n; i++)
+        atomic_inc(&local_hist[px[i]]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int i = lid; i < BINS; i += lsize) {
+        if (local_hist[i] != 0)
+            atomic_add(&hist[i], local_hist[i]);
+    }
+}
+
+// otsu's method: the threshold that maximises the variance between the pixels
+// at or below it and the ones above it. one work-group of BINS work-items,
+// the search itself is 256 steps and cheaper done by one of them than reduced.
+// clears hist for the next frame
+__kernel __attribute__((reqd_work_group_size(BINS, 1, 1)))
+void otsu(__global uint *hist,
+          __global int *thresh)
+{
+    __local float h[BINS];
+    const int lid = get_local_id(0);
+
+    h[lid] = hist[lid];
+    hist[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid != 0)
+        return;
+
+    float total = 0, sum = 0;
+    for (int i = 0; i < BINS; i++) {
+        total += h[i];
+        sum += i * h[i];
+    }
+
+    float w0 = 0, sum0 = 0, best = -1;
+    int t = 0;
+    for (int i = 0; i < BINS; i++) {
+        w0 += h[i];
+        sum0 += i * h[i];
+        const float w1 = total - w0;
+        if (w0 == 0)
+            continue;
+        if (w1 == 0)
+            break;
+        const float d = sum0 / w0 - (sum - sum0) / w1;
+        const float var = w0 * w1 * d * d;
+        if (var > best) {
+            best = var;
+            t = i;
+        }
+    }
+    thresh[0] = t;
+}
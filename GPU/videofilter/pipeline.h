@@ -0,0 +1,269 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <CL/cl.h>
+#include "opencv2/opencv.hpp"
+
+#include "helpers.h"
+#include "stages.h"
+#include "source.h"
+#include "queue.h"
+#include "sink.h"
+
+#define MAX_SLOTS 8
+
+
+// one frame in flight. the host pointers are only valid while the host owns the
+// slot, the gpu thread unmaps them before it enqueues any work on the buffers.
+// bgr is only there when the gpu does the gray conversion
+struct frame_slot {
+    cl_mem bgr_cl, gray_cl, edge_cl;
+    unsigned char *bgr_ptr, *gray_ptr, *edge_ptr;
+    cl_event ready;     // the last map when it wasn't blocking, NULL otherwise
+};
+
+struct pipeline {
+    gpu_stages *gpu = nullptr;
+    frame_source *camera = nullptr;
+    frame_sink *output = nullptr;
+    cv::Size size{};
+    int max_frames = 0;     // including the warm-up frames
+    int warmup = 0;
+    bool show = false;
+    const char *window_name = nullptr;
+
+    int num_slots = 0;
+    frame_slot slots[MAX_SLOTS];
+    slot_queue free_q{};        // ready to decode into
+    slot_queue decoded_q{};     // gray frame ready for the gpu
+    slot_queue filtered_q{};    // gray and edge mapped, ready to encode
+
+    // with several streams the decoded frames go to one shared queue for the
+    // scheduler instead, as stream * MAX_SLOTS + slot and -1 - stream at the end
+    slot_queue *sched_q = nullptr;
+    int stream = 0;
+
+    // set by encode_frames, the clock starts after the warm-up frames
+    int count = 0;
+    std::chrono::high_resolution_clock::time_point start{}, end{};
+};
+
+// decode thread: reads and converts frames straight into the mapped gray buffers
+void decode_frames(pipeline *p)
+{
+    for (int i = 0; i < p->max_frames; i++) {
+        int s = slot_queue_pop(&p->free_q);
+
+        // with the gpu conversion the decoder writes straight into the mapped bgr buffer
+        if (!source_read(p->camera, p->slots[s].gray_ptr, p->size.width, p->slots[s].bgr_ptr)) {
+            slot_queue_push(&p->free_q, s);
+            break;
+        }
+
+        if (p->sched_q != NULL)
+            slot_queue_push(p->sched_q, p->stream * MAX_SLOTS + s);
+        else
+            slot_queue_push(&p->decoded_q, s);
+    }
+    if (p->sched_q != NULL)
+        slot_queue_push(p->sched_q, -1 - p->stream);
+    else
+        slot_queue_push(&p->decoded_q, -1);
+}
+
+// gpu thread: owns every opencl call on the slots
+void filter_frames(pipeline *p)
+{
+    int status;
+    const size_t frame_size_bytes = p->gpu->frame_size_bytes;
+    profiler *prof = p->gpu->prof;
+    const bool profiling = prof != NULL && prof->enabled;
+
+    for (int frame = 0; ; frame++) {
+        int s = slot_queue_pop(&p->decoded_q);
+        if (s < 0)
+            break;
+        frame_slot *slot = &p->slots[s];
+
+        cl_event unmap_events[3];
+        cl_uint num_unmap_events = 2;
+        frame_events events;
+        clEnqueueUnmapMemObject(p->gpu->queue, slot->gray_cl, slot->gray_ptr, 0, NULL, &unmap_events[0]);
+        clEnqueueUnmapMemObject(p->gpu->queue, slot->edge_cl, slot->edge_ptr, 0, NULL, &unmap_events[1]);
+        if (slot->bgr_cl != NULL)
+            clEnqueueUnmapMemObject(p->gpu->queue, slot->bgr_cl, slot->bgr_ptr, 0, NULL, &unmap_events[num_unmap_events++]);
+        slot->gray_ptr = NULL;
+        slot->edge_ptr = NULL;
+        slot->bgr_ptr = NULL;
+        for (cl_uint i = 0; i < num_unmap_events; i++)
+            profile_add(prof, "unmap", unmap_events[i]);
+
+        status = enqueue_gpu_stages(p->gpu, slot->bgr_cl, slot->gray_cl, slot->edge_cl, num_unmap_events, unmap_events, &events);
+        checkError(status, "Failed to enqueue gpu stages");
+
+        // the maps wait on the last stage explicitly, the queue may be out of order
+        cl_event map_events[3] = { NULL, NULL, NULL };
+        slot->gray_ptr = (unsigned char *)clEnqueueMapBuffer(p->gpu->queue, slot->gray_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 1, &events.last,
+                                                             profiling ? &map_events[0] : NULL, &status);
+        checkError(status, "Failed to map slot gray buffer");
+        slot->edge_ptr = (unsigned char *)clEnqueueMapBuffer(p->gpu->queue, slot->edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 1, &events.last,
+                                                             profiling ? &map_events[1] : NULL, &status);
+        checkError(status, "Failed to map slot edge buffer");
+        if (slot->bgr_cl != NULL) {
+            slot->bgr_ptr = (unsigned char *)clEnqueueMapBuffer(p->gpu->queue, slot->bgr_cl, CL_TRUE, CL_MAP_WRITE, 0, 3 * frame_size_bytes, 1, &events.last,
+                                                                profiling ? &map_events[2] : NULL, &status);
+            checkError(status, "Failed to map slot bgr buffer");
+        }
+        for (int i = 0; i < 3; i++) {
+            profile_add(prof, "map", map_events[i]);
+            if (map_events[i] != NULL)
+                clReleaseEvent(map_events[i]);
+        }
+
+        frame_events_release(&events);
+        for (cl_uint i = 0; i < num_unmap_events; i++)
+            clReleaseEvent(unmap_events[i]);
+        profile_collect(prof, frame >= p->warmup);
+
+        slot_queue_push(&p->filtered_q, s);
+    }
+    slot_queue_push(&p->filtered_q, -1);
+}
+
+// allocates and maps the slot buffers on p->gpu->queue and queues them all as free
+void pipeline_alloc_slots(pipeline *p, cl_context context)
+{
+    int status;
+    gpu_stages *gpu = p->gpu;
+    const size_t frame_size_bytes = gpu->frame_size_bytes;
+
+    for (int s = 0; s < p->num_slots; s++) {
+        frame_slot *slot = &p->slots[s];
+        slot->gray_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, frame_size_bytes, NULL, &status);
+        checkError(status, "Failed to allocate slot gray buffer");
+        slot->edge_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, frame_size_bytes, NULL, &status);
+        checkError(status, "Failed to allocate slot edge buffer");
+
+        slot->gray_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, slot->gray_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
+        checkError(status, "Failed to map slot gray buffer");
+        slot->edge_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, slot->edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
+        checkError(status, "Failed to map slot edge buffer");
+
+        slot->bgr_cl = NULL;
+        slot->bgr_ptr = NULL;
+        if (gpu->gray_kernel != NULL) {
+            slot->bgr_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY, 3 * frame_size_bytes, NULL, &status);
+            checkError(status, "Failed to allocate slot bgr buffer");
+            slot->bgr_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, slot->bgr_cl, CL_TRUE, CL_MAP_WRITE, 0, 3 * frame_size_bytes, 0, NULL, NULL, &status);
+            checkError(status, "Failed to map slot bgr buffer");
+        }
+        slot->ready = NULL;
+
+        slot_queue_push(&p->free_q, s);
+    }
+}
+
+void pipeline_release_slots(pipeline *p)
+{
+    gpu_stages *gpu = p->gpu;
+    for (int s = 0; s < p->num_slots; s++) {
+        clEnqueueUnmapMemObject(gpu->queue, p->slots[s].gray_cl, p->slots[s].gray_ptr, 0, NULL, NULL);
+        clEnqueueUnmapMemObject(gpu->queue, p->slots[s].edge_cl, p->slots[s].edge_ptr, 0, NULL, NULL);
+        if (p->slots[s].bgr_cl != NULL)
+            clEnqueueUnmapMemObject(gpu->queue, p->slots[s].bgr_cl, p->slots[s].bgr_ptr, 0, NULL, NULL);
+    }
+    clFinish(gpu->queue);
+    for (int s = 0; s < p->num_slots; s++) {
+        clReleaseMemObject(p->slots[s].gray_cl);
+        clReleaseMemObject(p->slots[s].edge_cl);
+        if (p->slots[s].bgr_cl != NULL)
+            clReleaseMemObject(p->slots[s].bgr_cl);
+    }
+}
+
+// encode thread: masks, writes and shows the filtered frames until the end of
+// the stream and hands the slots back to the decoder
+void encode_frames(pipeline *p)
+{
+    int done = 0;
+    p->count = 0;
+    p->start = std::chrono::high_resolution_clock::now();
+    while (true) {
+        int s = slot_queue_pop(&p->filtered_q);
+        if (s < 0)
+            break;
+        frame_slot *slot = &p->slots[s];
+        if (slot->ready != NULL) {
+            clWaitForEvents(1, &slot->ready);
+            clReleaseEvent(slot->ready);
+            slot->ready = NULL;
+        }
+
+        // the fused kernel has already masked the frame into edge
+        cv::Mat displayframe(p->size, CV_8U, p->gpu->fused ? slot->edge_ptr : slot->gray_ptr);
+        if (!p->gpu->fused) {
+            cv::Mat edge(p->size, CV_8U, slot->edge_ptr);
+            cv::bitwise_and(displayframe, edge, displayframe);
+        }
+        sink_write(p->output, displayframe.data, displayframe.step);
+
+        if (p->show) {
+            cv::imshow(p->window_name, displayframe);
+            cv::waitKey(1);
+        }
+
+        // the warm-up frames aren't counted, the clock restarts after the last one
+        if (++done == p->warmup)
+            p->start = std::chrono::high_resolution_clock::now();
+        else if (done > p->warmup)
+            p->count++;
+        slot_queue_push(&p->free_q, s);
+    }
+    p->end = std::chrono::high_resolution_clock::now();
+}
+
+// runs decode, filtering and encode/display concurrently with num_slots frames
+// in flight. the calling thread masks and displays the frames, since highgui
+// wants to be on the main thread, and hands them to the writer thread of output.
+// the clock starts once warmup frames are through, returns the number of frames
+// written after that and their time in wall_ms
+int run_pipelined(gpu_stages *gpu, cl_context context, frame_source *camera, frame_sink *output,
+                  cv::Size size, int warmup, int max_frames, int num_slots, bool show, const char *window_name,
+                  double *wall_ms)
+{
+    pipeline *p = new pipeline();
+
+    p->gpu = gpu;
+    p->camera = camera;
+    p->output = output;
+    p->size = size;
+    p->max_frames = warmup + max_frames;
+    p->warmup = warmup;
+    p->show = show;
+    p->window_name = window_name;
+    p->num_slots = num_slots;
+    p->sched_q = NULL;
+    p->stream = 0;
+    pipeline_alloc_slots(p, context);
+
+    std::thread decoder(decode_frames, p);
+    std::thread filter(filter_frames, p);
+    encode_frames(p);
+
+    decoder.join();
+    filter.join();
+    auto tot_ms = std::chrono::duration_cast<std::chrono::microseconds>(p->end - p->start).count() / 1000.0;
+    printf("pipelined with %d slots: %d frames in %.1f ms, FPS: %.2lf (including load and disp)\n", num_slots, p->count, tot_ms, 1000.0 * p->count / tot_ms);
+    *wall_ms = tot_ms;
+
+    const int count = p->count;
+    pipeline_release_slots(p);
+    delete p;
+
+    return count;
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,186 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <CL/cl.h>
+
+#include "helpers.h"
+
+#define MAX_PROF_ROWS 16
+#define PROF_HIST_BUCKETS 24    // power of two buckets from 1 us up to 2^23 us
+
+
+// what is taken out of the four profiling timestamps of every command
+enum prof_metric {
+    PROF_QUEUE,     // QUEUED -> SUBMIT, waiting in the host side queue
+    PROF_SUBMIT,    // SUBMIT -> START, waiting on the device
+    PROF_EXEC,      // START -> END, running
+    PROF_TOTAL,     // QUEUED -> END
+    NUM_PROF_METRICS
+};
+
+static const char *prof_metric_names[NUM_PROF_METRICS] = { "queue", "submit", "exec", "total" };
+
+// every sample of one kind of command, in ms
+struct prof_row {
+    const char *name = nullptr;
+    std::vector<float> ms[NUM_PROF_METRICS];
+};
+
+// collects the device timestamps of every kernel, map and unmap. the events
+// are only read when the frame is done, so adding them doesn't block anything.
+// it isn't locked, all of it has to happen on the thread that owns the queue
+struct profiler {
+    bool enabled = false;
+    int num_rows = 0;
+    prof_row rows[MAX_PROF_ROWS];
+    std::vector<std::pair<const char *, cl_event> > pending{};
+};
+
+void profiler_init(profiler *p, bool enabled)
+{
+    p->enabled = enabled;
+    p->num_rows = 0;
+}
+
+// keeps ev until the next profile_collect. does nothing without profiling or event
+void profile_add(profiler *p, const char *name, cl_event ev)
+{
+    if (p == NULL || !p->enabled || ev == NULL)
+        return;
+    clRetainEvent(ev);
+    p->pending.push_back(std::make_pair(name, ev));
+}
+
+static prof_row *profile_row(profiler *p, const char *name)
+{
+    for (int i = 0; i < p->num_rows; i++) {
+        if (strcmp(p->rows[i].name, name) == 0)
+            return &p->rows[i];
+    }
+    if (p->num_rows == MAX_PROF_ROWS)
+        return NULL;
+    p->rows[p->num_rows].name = name;
+    return &p->rows[p->num_rows++];
+}
+
+// reads and releases the pending events. the ones from warm-up frames are
+// dropped with keep false
+void profile_collect(profiler *p, bool keep)
+{
+    if (p == NULL || !p->enabled)
+        return;
+
+    for (size_t i = 0; i < p->pending.size(); i++) {
+        cl_event ev = p->pending[i].second;
+        prof_row *row = keep ? profile_row(p, p->pending[i].first) : NULL;
+        if (row != NULL && clWaitForEvents(1, &ev) == CL_SUCCESS) {
+            cl_ulong t[4] = { 0, 0, 0, 0 };
+            const cl_profiling_info params[4] = {
+                CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END
+            };
+            int status = CL_SUCCESS;
+            for (int j = 0; j < 4 && status == CL_SUCCESS; j++)
+                status = clGetEventProfilingInfo(ev, params[j], sizeof(cl_ulong), &t[j], NULL);
+            checkError(status, "Failed to get event profiling info");
+
+            if (status == CL_SUCCESS) {
+                // some drivers report 0 or out of order queued/submit times for maps
+                for (int j = 1; j < 4; j++)
+                    t[j] = t[j] > t[j - 1] ? t[j] : t[j - 1];
+                row->ms[PROF_QUEUE].push_back((t[1] - t[0]) / 1.0e6f);
+                row->ms[PROF_SUBMIT].push_back((t[2] - t[1]) / 1.0e6f);
+                row->ms[PROF_EXEC].push_back((t[3] - t[2]) / 1.0e6f);
+                row->ms[PROF_TOTAL].push_back((t[3] - t[0]) / 1.0e6f);
+            }
+        }
+        clReleaseEvent(ev);
+    }
+    p->pending.clear();
+}
+
+struct prof_stats {
+    size_t count;
+    float mean, p50, p90, p99, max;
+    int hist[PROF_HIST_BUCKETS];    // hist[i] counts samples up to 2^i us
+};
+
+// nearest rank percentiles, sorts samples
+static void prof_compute_stats(std::vector<float> &samples, prof_stats *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->count = samples.size();
+    if (s->count == 0)
+        return;
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < s->count; i++) {
+        sum += samples[i];
+        int bucket = 0;
+        while (bucket < PROF_HIST_BUCKETS - 1 && samples[i] * 1000.0f > (float)(1 << bucket))
+            bucket++;
+        s->hist[bucket]++;
+    }
+    s->mean = sum / s->count;
+    s->p50 = samples[(s->count - 1) * 50 / 100];
+    s->p90 = samples[(s->count - 1) * 90 / 100];
+    s->p99 = samples[(s->count - 1) * 99 / 100];
+    s->max = samples[s->count - 1];
+}
+
+// one line per row and metric. json if path ends in .json, otherwise csv, "-" is stdout
+void profile_write(profiler *p, const char *path)
+{
+    if (p == NULL || !p->enabled || path == NULL)
+        return;
+
+    FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (fp == NULL) {
+        printf("can't open profile file %s\n", path);
+        return;
+    }
+    const size_t len = strlen(path);
+    const bool json = len > 5 && strcmp(path + len - 5, ".json") == 0;
+
+    if (json)
+        fprintf(fp, "[\n");
+    else
+        fprintf(fp, "stage,metric,count,mean_ms,p50_ms,p90_ms,p99_ms,max_ms\n");
+
+    bool first = true;
+    for (int r = 0; r < p->num_rows; r++) {
+        for (int m = 0; m < NUM_PROF_METRICS; m++) {
+            prof_stats s;
+            prof_compute_stats(p->rows[r].ms[m], &s);
+            if (!json) {
+                fprintf(fp, "%s,%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f\n", p->rows[r].name, prof_metric_names[m],
+                        s.count, s.mean, s.p50, s.p90, s.p99, s.max);
+                continue;
+            }
+
+            // the histogram is cut after the last non-empty bucket
+            int last = PROF_HIST_BUCKETS - 1;
+            while (last > 0 && s.hist[last] == 0)
+                last--;
+            fprintf(fp, "%s  {\"stage\": \"%s\", \"metric\": \"%s\", \"count\": %zu, \"mean_ms\": %.4f, "
+                        "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"hist_pow2_us\": [",
+                    first ? "" : ",\n", p->rows[r].name, prof_metric_names[m], s.count, s.mean, s.p50, s.p90, s.p99, s.max);
+            for (int b = 0; b <= last; b++)
+                fprintf(fp, "%s%d", b == 0 ? "" : ", ", s.hist[b]);
+            fprintf(fp, "]}");
+            first = false;
+        }
+    }
+    if (json)
+        fprintf(fp, "\n]\n");
+
+    if (fp != stdout)
+        fclose(fp);
+}
+
+#endif // PROFILE_H
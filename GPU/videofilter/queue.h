@@ -0,0 +1,35 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+
+// blocking fifo of slot indices, negative values mark the end of the stream. it
+// never holds more than the number of slots, so it doesn't need its own bound
+struct slot_queue {
+    std::deque<int> items{};
+    std::mutex lock{};
+    std::condition_variable ready{};
+};
+
+void slot_queue_push(slot_queue *q, int slot)
+{
+    {
+        std::lock_guard<std::mutex> guard(q->lock);
+        q->items.push_back(slot);
+    }
+    q->ready.notify_one();
+}
+
+int slot_queue_pop(slot_queue *q)
+{
+    std::unique_lock<std::mutex> guard(q->lock);
+    q->ready.wait(guard, [q] { return !q->items.empty(); });
+    int slot = q->items.front();
+    q->items.pop_front();
+    return slot;
+}
+
+#endif // QUEUE_H
@@ -0,0 +1,86 @@
+// separable convolution: a row pass into a float scratch buffer followed by a
+// column pass back to uchar. a (2r+1)x(2r+1) filter costs 2*(2r+1) multiplies
+// per pixel instead of (2r+1)^2. pixels outside the frame are clamped to the edge,
+// with PADDED the row passes read them from the border instead. the scratch is
+// packed. the third dimension picks the frame in a batch, which is packed too
+
+#ifdef PADDED
+#define COL(x) (x)
+#else
+#define COL(x) clamp(x, 0, width - 1)
+#endif
+
+__kernel void row_pass(__global const uchar *in,
+                       __global float *out,
+                       const int width,
+                       const int height,
+                       const int pitch,
+                       const int origin,
+                       const int radius,
+                       __constant float *w)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    const size_t frame = get_global_id(2) * (size_t)width * height;
+    __global const uchar *row = in + origin + get_global_id(2) * (size_t)pitch * height + y * pitch;
+    out += frame;
+
+    float res = 0;
+    for (int i = -radius; i <= radius; i++)
+        res += row[COL(x + i)] * w[radius + i];
+
+    out[y * width + x] = res;
+}
+
+// two row filters over the same input, so sobel x and sobel y only read the
+// frame once between them
+__kernel void row_pass2(__global const uchar *in,
+                        __global float *out_a,
+                        __global float *out_b,
+                        const int width,
+                        const int height,
+                        const int pitch,
+                        const int origin,
+                        const int radius,
+                        __constant float *w_a,
+                        __constant float *w_b)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    const size_t frame = get_global_id(2) * (size_t)width * height;
+    __global const uchar *row = in + origin + get_global_id(2) * (size_t)pitch * height + y * pitch;
+    out_a += frame;
+    out_b += frame;
+
+    float res_a = 0;
+    float res_b = 0;
+    for (int i = -radius; i <= radius; i++) {
+        float px = row[COL(x + i)];
+        res_a += px * w_a[radius + i];
+        res_b += px * w_b[radius + i];
+    }
+
+    out_a[y * width + x] = res_a;
+    out_b[y * width + x] = res_b;
+}
+
+__kernel void col_pass(__global const float *in,
+                       __global uchar *out,
+                       const int width,
+                       const int height,
+                       const int pitch,
+                       const int origin,
+                       const int radius,
+                       __constant float *w)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    in += get_global_id(2) * (size_t)width * height;
+    out += origin + get_global_id(2) * (size_t)pitch * height;
+
+    float res = 0;
+    for (int i = -radius; i <= radius; i++)
+        res += in[clamp(y + i, 0, height - 1) * width + x] * w[radius + i];
+
+    out[y * pitch + x] = convert_uchar_sat(res);
+}
@@ -0,0 +1,205 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include "opencv2/opencv.hpp"
+
+#include "queue.h"
+
+#define SINK_BUFFERS 4                  // frames queued for the writer thread
+#define SINK_WRITE_SIZE (4 << 20)       // raw output is written in chunks of this
+#define SINK_ALIGN 4096                 // O_DIRECT wants aligned buffers, offsets and sizes
+
+
+enum sink_kind {
+    SINK_AUTO,      // from the extension of the output, mjpg for anything unknown
+    SINK_MJPG,      // VideoWriter with MJPG, what the output always was
+    SINK_Y4M,       // mono y4m, playable and readable back as input
+    SINK_GRAY,      // headerless 8 bit frames back to back
+    SINK_NULL       // nothing is written, for benchmarking the filter alone
+};
+
+static const char *sink_kind_names[] = { "auto", "mjpg", "y4m", "gray", "null" };
+
+const char *sink_kind_name(sink_kind kind)
+{
+    return sink_kind_names[kind];
+}
+
+// the masked frames go out through this. sink_write only copies the frame into
+// one of SINK_BUFFERS buffers and the encoding or writing happens on a thread of
+// its own, so the caller is only held up when the writer is that far behind
+struct frame_sink {
+    sink_kind kind = SINK_AUTO;
+    cv::Size size{};
+    cv::VideoWriter writer{};
+
+    // raw output, collected into out_buf and written SINK_WRITE_SIZE at a time
+    int fd = -1;
+    bool direct = false;    // opened with O_DIRECT, the page cache is bypassed
+    unsigned char *out_buf = nullptr;
+    size_t out_used = 0;
+
+    unsigned char *frames[SINK_BUFFERS];
+    slot_queue free_q{};    // buffers the caller can copy into
+    slot_queue full_q{};    // frames for the writer, -1 at the end
+    std::thread writer_thread{};
+};
+
+sink_kind sink_kind_of(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (ext != NULL && strcmp(ext, ".y4m") == 0)
+        return SINK_Y4M;
+    if (ext != NULL && (strcmp(ext, ".gray") == 0 || strcmp(ext, ".y8") == 0))
+        return SINK_GRAY;
+    return SINK_MJPG;
+}
+
+static bool sink_flush(frame_sink *sink, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = write(sink->fd, sink->out_buf + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("sink write");
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static void sink_append(frame_sink *sink, const unsigned char *data, size_t bytes)
+{
+    while (bytes > 0) {
+        size_t n = SINK_WRITE_SIZE - sink->out_used;
+        n = n < bytes ? n : bytes;
+        memcpy(sink->out_buf + sink->out_used, data, n);
+        sink->out_used += n;
+        data += n;
+        bytes -= n;
+        if (sink->out_used == SINK_WRITE_SIZE) {
+            sink_flush(sink, SINK_WRITE_SIZE);
+            sink->out_used = 0;
+        }
+    }
+}
+
+// writer thread: encodes or appends the queued frames until the end marker
+static void sink_write_frames(frame_sink *sink)
+{
+    const size_t frame_px = (size_t)sink->size.width * sink->size.height;
+    while (true) {
+        int b = slot_queue_pop(&sink->full_q);
+        if (b < 0)
+            break;
+        if (sink->kind == SINK_MJPG) {
+            sink->writer << cv::Mat(sink->size, CV_8U, sink->frames[b]);
+        } else {
+            if (sink->kind == SINK_Y4M)
+                sink_append(sink, (const unsigned char *)"FRAME\n", 6);
+            sink_append(sink, sink->frames[b], frame_px);
+        }
+        slot_queue_push(&sink->free_q, b);
+    }
+}
+
+// opens path for size frames of 8 bit gray. kind SINK_AUTO goes by the extension
+bool sink_open(frame_sink *sink, sink_kind kind, const char *path, cv::Size size)
+{
+    sink->kind = kind == SINK_AUTO ? sink_kind_of(path) : kind;
+    sink->size = size;
+    sink->fd = -1;
+    sink->out_buf = NULL;
+    sink->out_used = 0;
+    for (int b = 0; b < SINK_BUFFERS; b++)
+        sink->frames[b] = NULL;
+    if (sink->kind == SINK_NULL)
+        return true;
+
+    if (sink->kind == SINK_MJPG) {
+        if (!sink->writer.open(path, CV_FOURCC('M','J','P','G'), 25, size, true))
+            return false;
+    } else {
+        // not every file system takes O_DIRECT, those get the page cache
+        sink->direct = true;
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (sink->fd < 0 && errno == EINVAL) {
+            sink->direct = false;
+            sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (sink->fd < 0)
+            return false;
+        if (posix_memalign((void **)&sink->out_buf, SINK_ALIGN, SINK_WRITE_SIZE) != 0) {
+            close(sink->fd);
+            return false;
+        }
+        if (sink->kind == SINK_Y4M) {
+            char header[64];
+            int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F25:1 Ip A1:1 Cmono\n", size.width, size.height);
+            sink_append(sink, (const unsigned char *)header, len);
+        }
+    }
+
+    const size_t frame_px = (size_t)size.width * size.height;
+    for (int b = 0; b < SINK_BUFFERS; b++) {
+        sink->frames[b] = new unsigned char[frame_px];
+        slot_queue_push(&sink->free_q, b);
+    }
+    sink->writer_thread = std::thread(sink_write_frames, sink);
+    return true;
+}
+
+// queues a packed copy of frame, whose rows are pitch bytes apart. blocks only
+// while all buffers are waiting to be written
+void sink_write(frame_sink *sink, const unsigned char *frame, size_t pitch)
+{
+    if (sink->kind == SINK_NULL)
+        return;
+    int b = slot_queue_pop(&sink->free_q);
+    const size_t width = sink->size.width;
+    if (pitch == width) {
+        memcpy(sink->frames[b], frame, width * sink->size.height);
+    } else {
+        for (int y = 0; y < sink->size.height; y++)
+            memcpy(sink->frames[b] + y * width, frame + y * pitch, width);
+    }
+    slot_queue_push(&sink->full_q, b);
+}
+
+// writes out what is queued and closes the file
+void sink_close(frame_sink *sink)
+{
+    if (sink->kind == SINK_NULL)
+        return;
+    slot_queue_push(&sink->full_q, -1);
+    sink->writer_thread.join();
+
+    if (sink->fd >= 0) {
+        // the tail isn't a whole block, so it goes through the page cache
+        if (sink->out_used > 0) {
+            if (sink->direct)
+                fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) & ~O_DIRECT);
+            sink_flush(sink, sink->out_used);
+        }
+        close(sink->fd);
+        free(sink->out_buf);
+        sink->fd = -1;
+    }
+    sink->writer.release();
+    for (int b = 0; b < SINK_BUFFERS; b++) {
+        delete[] sink->frames[b];
+        sink->frames[b] = NULL;
+    }
+}
+
+#endif // SINK_H
@@ -0,0 +1,202 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "opencv2/opencv.hpp"
+
+
+enum raw_format {
+    RAW_NONE,       // not raw, decoded with VideoCapture
+    RAW_Y4M,        // .y4m, size and chroma layout from the header
+    RAW_GRAY,       // .gray or .y8, headerless 8 bit luma frames
+    RAW_YUV420      // .yuv, headerless 8 bit planar 4:2:0, only the luma plane is used
+};
+
+// where the frames come from. raw files are mmapped and the luma plane of
+// every frame is copied straight from the page cache into the frame buffer,
+// with no decode, no temporary Mat and no color conversion
+struct frame_source {
+    raw_format format = RAW_NONE;
+    cv::VideoCapture camera{};
+    cv::Mat scratch{};      // decoded frame when it can't be decoded in place
+
+    int width = 0, height = 0;
+    unsigned char *data = nullptr;  // the mapped file
+    size_t file_size = 0;
+    size_t pos = 0;                 // start of the next frame
+    size_t frame_bytes = 0;         // planes of one frame, without the y4m FRAME line
+};
+
+static raw_format raw_format_of(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (ext == NULL)
+        return RAW_NONE;
+    if (strcmp(ext, ".y4m") == 0)
+        return RAW_Y4M;
+    if (strcmp(ext, ".gray") == 0 || strcmp(ext, ".y8") == 0)
+        return RAW_GRAY;
+    if (strcmp(ext, ".yuv") == 0)
+        return RAW_YUV420;
+    return RAW_NONE;
+}
+
+// reads the stream header, e.g. "YUV4MPEG2 W640 H360 F25:1 Ip A1:1 C420jpeg"
+static bool y4m_parse_header(frame_source *src)
+{
+    const char *p = (const char *)src->data;
+    const char *end = (const char *)memchr(p, '\n', src->file_size);
+    if (end == NULL || src->file_size < 10 || strncmp(p, "YUV4MPEG2 ", 10) != 0)
+        return false;
+
+    char chroma[32] = "420";
+    src->width = src->height = 0;
+    for (const char *tok = p + 9; tok < end; tok++) {
+        if (*tok != ' ')
+            continue;
+        if (tok[1] == 'W')
+            src->width = atoi(tok + 2);
+        else if (tok[1] == 'H')
+            src->height = atoi(tok + 2);
+        else if (tok[1] == 'C')
+            sscanf(tok + 2, "%31[^ \n]", chroma);
+    }
+
+    const size_t luma = (size_t)src->width * src->height;
+    const size_t half_w = (src->width + 1) / 2;
+    const size_t half_h = (src->height + 1) / 2;
+    if (strncmp(chroma, "420", 3) == 0 && strstr(chroma, "p1") == NULL) {
+        src->frame_bytes = luma + 2 * half_w * half_h;
+    } else if (strcmp(chroma, "422") == 0) {
+        src->frame_bytes = luma + 2 * half_w * src->height;
+    } else if (strcmp(chroma, "444") == 0) {
+        src->frame_bytes = 3 * luma;
+    } else if (strcmp(chroma, "mono") == 0) {
+        src->frame_bytes = luma;
+    } else {
+        printf("unsupported y4m chroma layout C%s, only 8 bit 420, 422, 444 and mono\n", chroma);
+        return false;
+    }
+
+    src->pos = end + 1 - p;
+    return src->width > 0 && src->height > 0;
+}
+
+// opens path, as a raw file if the extension says so. headerless raw files
+// need the frame size in width and height, the others ignore them
+bool source_open(frame_source *src, const char *path, int width, int height)
+{
+    src->format = raw_format_of(path);
+    src->data = NULL;
+    if (src->format == RAW_NONE) {
+        if (!src->camera.open(path))
+            return false;
+        src->width = (int)src->camera.get(CV_CAP_PROP_FRAME_WIDTH);
+        src->height = (int)src->camera.get(CV_CAP_PROP_FRAME_HEIGHT);
+        return true;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    src->file_size = st.st_size;
+    src->data = (unsigned char *)mmap(NULL, src->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src->data == MAP_FAILED) {
+        src->data = NULL;
+        return false;
+    }
+    // frames are read front to back once, so ask for aggressive read-ahead
+    madvise(src->data, src->file_size, MADV_SEQUENTIAL);
+
+    if (src->format == RAW_Y4M)
+        return y4m_parse_header(src);
+
+    if (width <= 0 || height <= 0) {
+        printf("%s has no header, give its frame size with --size\n", path);
+        return false;
+    }
+    src->width = width;
+    src->height = height;
+    src->pos = 0;
+    src->frame_bytes = (size_t)width * height;
+    if (src->format == RAW_YUV420)
+        src->frame_bytes += 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    return true;
+}
+
+cv::Size source_size(const frame_source *src)
+{
+    return cv::Size(src->width, src->height);
+}
+
+// reads the next frame into the gray frame buffer, gray_pitch bytes a row, or
+// as packed bgr into bgr when that isn't NULL. raw files are gray only. returns
+// false at the end
+bool source_read(frame_source *src, unsigned char *gray, size_t gray_pitch, unsigned char *bgr)
+{
+    const cv::Size size = source_size(src);
+
+    if (src->format == RAW_NONE) {
+        if (bgr != NULL) {
+            // decodes in place when the size matches
+            src->scratch = cv::Mat(size, CV_8UC3, bgr);
+            src->camera >> src->scratch;
+            if (src->scratch.empty())
+                return false;
+            if (src->scratch.data != bgr)
+                src->scratch.copyTo(cv::Mat(size, CV_8UC3, bgr));
+            return true;
+        }
+
+        src->camera >> src->scratch;
+        if (src->scratch.empty())
+            return false;
+        cv::Mat gray_mat(size, CV_8U, gray, gray_pitch);
+        cv::cvtColor(src->scratch, gray_mat, CV_BGR2GRAY);
+        return true;
+    }
+
+    if (src->format == RAW_Y4M) {
+        // every frame starts with a FRAME line, which may have parameters
+        if (src->pos + 5 > src->file_size || memcmp(src->data + src->pos, "FRAME", 5) != 0)
+            return false;
+        const unsigned char *eol = (const unsigned char *)memchr(src->data + src->pos, '\n', src->file_size - src->pos);
+        if (eol == NULL)
+            return false;
+        src->pos = eol + 1 - src->data;
+    }
+    if (src->pos + src->frame_bytes > src->file_size)
+        return false;
+
+    if (gray_pitch == (size_t)src->width) {
+        memcpy(gray, src->data + src->pos, (size_t)src->width * src->height);
+    } else {
+        for (int y = 0; y < src->height; y++)
+            memcpy(gray + y * gray_pitch, src->data + src->pos + (size_t)y * src->width, src->width);
+    }
+    src->pos += src->frame_bytes;
+    return true;
+}
+
+void source_close(frame_source *src)
+{
+    if (src->data != NULL) {
+        munmap(src->data, src->file_size);
+        src->data = NULL;
+    }
+    src->camera.release();
+}
+
+#endif // SOURCE_H
@@ -0,0 +1,366 @@
+#ifndef STAGES_H
+#define STAGES_H
+
+#include <CL/cl.h>
+
+#include "helpers.h"
+#include "convolution.h"
+#include "profile.h"
+#include "tune.h"
+
+
+// how independent stages (sobel x and y) are submitted
+enum concurrency {
+    CONCURRENT_NONE,    // one in-order queue
+    CONCURRENT_OOO,     // one out-of-order queue, ordering only from events
+    CONCURRENT_MULTI    // sobel y on a second in-order queue
+};
+
+enum gpu_stage_id {
+    STAGE_GRAY,
+    STAGE_GAUSS,
+    STAGE_SOBEL_X,
+    STAGE_SOBEL_Y,
+    STAGE_AVERAGE,
+    STAGE_THRESHOLD,
+    STAGE_FUSED,
+    STAGE_CHANGES,
+    STAGE_NMS,
+    STAGE_HYSTERESIS,
+    NUM_STAGES
+};
+
+// event of the last command of every stage that ran (NULL for the others),
+// last is whichever of them finishes the frame
+struct frame_events {
+    cl_event stage[NUM_STAGES];
+    cl_event last;
+};
+
+// everything the gpu side of one frame needs
+struct gpu_stages {
+    cl_command_queue queue;
+    cl_command_queue side_queue;    // second queue for --concurrent multi, otherwise queue
+    // size of the frame buffers, a whole batch with --batch. the elementwise
+    // kernels (average, threshold, mask) go over all of it, the border and
+    // padding of a padded frame too, which keeps a replicated border replicated
+    size_t frame_size_bytes;
+
+    // with --gray gpu the frame comes in as packed bgr and is converted here
+    cl_kernel gray_kernel;      // NULL when the host converts
+    bool gray_fused;            // gray_kernel also does the first gaussian pass
+    size_t gray_global_size[2];
+    const char *gray_name;      // its kernel name, for the tuned local size
+
+    bool fused;
+    cl_kernel fused_kernel;
+    size_t fused_global_size[2];
+    size_t fused_local_size[2];
+
+    // with --incremental the fused kernel only refilters tiles near the ones
+    // changes_kernel found changed since they were last filtered
+    cl_kernel changes_kernel;   // NULL when every tile is filtered
+    cl_mem changes_ref_cl;      // every tile as it was last filtered
+    cl_mem dirty_cl;            // one flag per tile
+    int changes_min_sad;        // sum of absolute differences a tile needs to be dirty
+    bool changes_primed;        // ref holds a frame, until then every tile is dirty
+    unsigned char *dirty;       // host copy of dirty_cl for tiles_refiltered
+
+    conv_stage *conv;
+    const conv_filter *gaussian, *sobel_x, *sobel_y;
+    cl_kernel average_kernel, threshold_kernel;
+    int average_vec, threshold_vec;     // pixels per work-item they were built for
+    cl_mem edge_x_cl, edge_y_cl;    // scratch, also used for the gaussian ping-pong
+
+    // with --otsu the threshold is picked on the device for every frame
+    cl_kernel hist_kernel;          // NULL for the fixed threshold
+    cl_kernel otsu_kernel, adaptive_threshold_kernel;
+    size_t hist_global_size[2];     // 16 pixels of a row per work-item
+    cl_mem hist_cl;                 // 256 bins, left zeroed by the otsu kernel
+    cl_mem thresh_cl;               // one int
+
+    // with --canny these replace sobel, average and threshold
+    cl_kernel canny_nms_kernel;     // NULL for the sobel edges
+    cl_kernel canny_hyst_kernel, canny_mask_kernel;
+    int canny_passes;               // hysteresis passes, every one carries edges one tile further
+    size_t canny_global_size[2];
+    size_t canny_local_size[2];
+
+    const tune_table *tune;     // local sizes of the kernels without a tile size, may be NULL
+    profiler *prof;     // gets every command enqueued here, may be NULL
+};
+
+void frame_events_release(frame_events *ev)
+{
+    for (int i = 0; i < NUM_STAGES; i++) {
+        if (ev->stage[i] != NULL)
+            clReleaseEvent(ev->stage[i]);
+        ev->stage[i] = NULL;
+    }
+    ev->last = NULL;
+}
+
+// marks the tiles of in that changed since they were last filtered, for the
+// incremental fused kernel. the first call marks all of them
+cl_int enqueue_tile_changes(gpu_stages *g, cl_mem in, cl_uint num_events, const cl_event *wait_list, cl_event *ev)
+{
+    const int min_sad = g->changes_primed ? g->changes_min_sad : -1;
+    int status = clSetKernelArg(g->changes_kernel, 0, sizeof(cl_mem), &in);
+    checkError(status, "Failed to set in param in tile changes kernel");
+    status = clSetKernelArg(g->changes_kernel, 7, sizeof(int), &min_sad);
+    checkError(status, "Failed to set min_sad param in tile changes kernel");
+    status = clEnqueueNDRangeKernel(g->queue, g->changes_kernel, 2, NULL, g->fused_global_size, g->fused_local_size,
+                                    num_events, wait_list, ev);
+    if (status == CL_SUCCESS) {
+        g->changes_primed = true;
+        profile_add(g->prof, "changes", *ev);
+    }
+    return status;
+}
+
+// how many tiles the incremental fused kernel filtered in the last frame,
+// the dirty ones and their neighbours. waits for the flags to be read back
+int tiles_refiltered(gpu_stages *g)
+{
+    const int tiles_x = g->fused_global_size[0] / g->fused_local_size[0];
+    const int tiles_y = g->fused_global_size[1] / g->fused_local_size[1];
+    int status = clEnqueueReadBuffer(g->queue, g->dirty_cl, CL_TRUE, 0, tiles_x * tiles_y, g->dirty, 0, NULL, NULL);
+    checkError(status, "Failed to read tile flags");
+
+    int count = 0;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            bool stale = false;
+            for (int j = ty > 0 ? ty - 1 : 0; j <= ty + 1 && j < tiles_y; j++) {
+                for (int i = tx > 0 ? tx - 1 : 0; i <= tx + 1 && i < tiles_x; i++)
+                    stale = stale || g->dirty[j * tiles_x + i];
+            }
+            count += stale;
+        }
+    }
+    return count;
+}
+
+// the threshold stage with --otsu: histogram of edge_cl, otsu's threshold from
+// it into thresh_cl and the threshold kernel reading that, all on the device
+cl_int enqueue_otsu_threshold(gpu_stages *g, cl_mem edge_cl, cl_uint num_events, const cl_event *wait_list, cl_event *ev)
+{
+    const size_t work_size = g->frame_size_bytes / g->threshold_vec;
+    const size_t otsu_size = 256;
+    cl_event hist_event = NULL, otsu_event = NULL;
+
+    int status = clSetKernelArg(g->hist_kernel, 0, sizeof(cl_mem), &edge_cl);
+    checkError(status, "Failed to set img param in histogram kernel");
+    status = clEnqueueNDRangeKernel(g->queue, g->hist_kernel, 2, NULL, g->hist_global_size, tune_local(g->tune, "histogram"),
+                                    num_events, wait_list, &hist_event);
+    if (status == CL_SUCCESS) {
+        profile_add(g->prof, "histogram", hist_event);
+        status = clEnqueueNDRangeKernel(g->queue, g->otsu_kernel, 1, NULL, &otsu_size, &otsu_size, 1, &hist_event, &otsu_event);
+    }
+    if (status == CL_SUCCESS) {
+        profile_add(g->prof, "otsu", otsu_event);
+        status = clSetKernelArg(g->adaptive_threshold_kernel, 0, sizeof(cl_mem), &edge_cl);
+        checkError(status, "Failed to set img param in adaptive threshold kernel");
+        // same build and range as the fixed threshold, so it takes its local size
+        status = clEnqueueNDRangeKernel(g->queue, g->adaptive_threshold_kernel, 1, NULL, &work_size, tune_local(g->tune, "threshold"),
+                                        1, &otsu_event, ev);
+    }
+    if (status == CL_SUCCESS)
+        profile_add(g->prof, "threshold", *ev);
+
+    if (hist_event != NULL)
+        clReleaseEvent(hist_event);
+    if (otsu_event != NULL)
+        clReleaseEvent(otsu_event);
+    return status;
+}
+
+// the canny stages after the gaussian: gradient and non-maximum suppression
+// from gray_cl into edge_x, the hysteresis passes ping-ponging between edge_x
+// and edge_y and the mask from the last of them into edge_cl
+static cl_int enqueue_canny(gpu_stages *g, cl_mem gray_cl, cl_mem edge_cl, frame_events *e)
+{
+    int status = clSetKernelArg(g->canny_nms_kernel, 0, sizeof(cl_mem), &gray_cl);
+    checkError(status, "Failed to set in param in canny nms kernel");
+    status = clSetKernelArg(g->canny_nms_kernel, 1, sizeof(cl_mem), &g->edge_x_cl);
+    checkError(status, "Failed to set labels param in canny nms kernel");
+    status = clEnqueueNDRangeKernel(g->queue, g->canny_nms_kernel, 2, NULL, g->canny_global_size, g->canny_local_size,
+                                    1, &e->stage[STAGE_GAUSS], &e->stage[STAGE_NMS]);
+    if (status != CL_SUCCESS)
+        return status;
+    profile_add(g->prof, "nms", e->stage[STAGE_NMS]);
+
+    cl_mem labels[2] = { g->edge_x_cl, g->edge_y_cl };
+    cl_event prev = e->stage[STAGE_NMS];
+    for (int i = 0; i < g->canny_passes; i++) {
+        status = clSetKernelArg(g->canny_hyst_kernel, 0, sizeof(cl_mem), &labels[i % 2]);
+        checkError(status, "Failed to set in param in canny hysteresis kernel");
+        status = clSetKernelArg(g->canny_hyst_kernel, 1, sizeof(cl_mem), &labels[(i + 1) % 2]);
+        checkError(status, "Failed to set out param in canny hysteresis kernel");
+        cl_event ev;
+        status = clEnqueueNDRangeKernel(g->queue, g->canny_hyst_kernel, 2, NULL, g->canny_global_size, g->canny_local_size,
+                                        1, &prev, &ev);
+        if (e->stage[STAGE_HYSTERESIS] != NULL)
+            clReleaseEvent(e->stage[STAGE_HYSTERESIS]);
+        e->stage[STAGE_HYSTERESIS] = status == CL_SUCCESS ? ev : NULL;
+        if (status != CL_SUCCESS)
+            return status;
+        profile_add(g->prof, "hysteresis", ev);
+        prev = ev;
+    }
+
+    const size_t mask_work_size = g->frame_size_bytes / 16;
+    status = clSetKernelArg(g->canny_mask_kernel, 0, sizeof(cl_mem), &labels[g->canny_passes % 2]);
+    checkError(status, "Failed to set labels param in canny mask kernel");
+    status = clSetKernelArg(g->canny_mask_kernel, 1, sizeof(cl_mem), &edge_cl);
+    checkError(status, "Failed to set out param in canny mask kernel");
+    status = clEnqueueNDRangeKernel(g->queue, g->canny_mask_kernel, 1, NULL, &mask_work_size, tune_local(g->tune, "canny_mask"),
+                                    1, &prev, &e->stage[STAGE_THRESHOLD]);
+    if (status == CL_SUCCESS)
+        profile_add(g->prof, "canny_mask", e->stage[STAGE_THRESHOLD]);
+    return status;
+}
+
+// enqueues gaussian x3, sobel x/y, average and threshold (or the fused kernel)
+// on gray_cl, leaving the blurred frame in gray_cl and the edge mask in edge_cl.
+// with --canny the mask comes from the canny stages instead of sobel, average
+// and threshold, with --otsu the threshold is picked from the histogram of
+// every frame. with --fused edge_cl gets the masked frame instead, with
+// --incremental only in the tiles that changed. when the gpu does the gray
+// conversion gray_cl is filled from bgr_cl first. every command waits on the
+// event of the stage before it and the first ones on wait_list, so nothing
+// here blocks the host. if ev is NULL the events are released right away
+cl_int enqueue_gpu_stages(gpu_stages *g, cl_mem bgr_cl, cl_mem gray_cl, cl_mem edge_cl,
+                          cl_uint num_events, const cl_event *wait_list, frame_events *ev)
+{
+    int status;
+    frame_events local;
+    frame_events *e = ev != NULL ? ev : &local;
+
+    for (int i = 0; i < NUM_STAGES; i++)
+        e->stage[i] = NULL;
+    e->last = NULL;
+
+    if (g->gray_kernel != NULL) {
+        // the fused version does the first gaussian pass, gray -> edge_x below
+        cl_mem gray_out = g->gray_fused ? g->edge_x_cl : gray_cl;
+        status = clSetKernelArg(g->gray_kernel, 0, sizeof(cl_mem), &bgr_cl);
+        checkError(status, "Failed to set in param in gray kernel");
+        status = clSetKernelArg(g->gray_kernel, 1, sizeof(cl_mem), &gray_out);
+        checkError(status, "Failed to set out param in gray kernel");
+        status = clEnqueueNDRangeKernel(g->queue, g->gray_kernel, 2, NULL, g->gray_global_size, tune_local(g->tune, g->gray_name),
+                                        num_events, wait_list, &e->stage[STAGE_GRAY]);
+        profile_add(g->prof, "gray", e->stage[STAGE_GRAY]);
+        if (status != CL_SUCCESS) {
+            frame_events_release(e);
+            return status;
+        }
+        num_events = 1;
+        wait_list = &e->stage[STAGE_GRAY];
+    }
+
+    if (g->fused && g->changes_kernel != NULL) {
+        status = enqueue_tile_changes(g, gray_cl, num_events, wait_list, &e->stage[STAGE_CHANGES]);
+        if (status != CL_SUCCESS) {
+            frame_events_release(e);
+            return status;
+        }
+        num_events = 1;
+        wait_list = &e->stage[STAGE_CHANGES];
+    }
+
+    if (g->fused) {
+        status = clSetKernelArg(g->fused_kernel, 0, sizeof(cl_mem), &gray_cl);
+        checkError(status, "Failed to set in param in fused kernel");
+        status = clSetKernelArg(g->fused_kernel, 1, sizeof(cl_mem), &edge_cl);
+        checkError(status, "Failed to set out param in fused kernel");
+        status = clEnqueueNDRangeKernel(g->queue, g->fused_kernel, 2, NULL, g->fused_global_size, g->fused_local_size,
+                                        num_events, wait_list, &e->stage[STAGE_FUSED]);
+        profile_add(g->prof, "fused", e->stage[STAGE_FUSED]);
+        e->last = e->stage[STAGE_FUSED];
+        if (ev == NULL)
+            frame_events_release(e);
+        return status;
+    }
+
+    status = CL_SUCCESS;
+    cl_mem gauss_bufs[4] = { gray_cl, g->edge_x_cl, g->edge_y_cl, gray_cl };
+    for (int i = g->gray_fused ? 1 : 0; i < 3 && status == CL_SUCCESS; i++) {
+        cl_event prev = e->stage[STAGE_GAUSS];
+        if (prev == NULL)
+            status = conv_enqueue(g->conv, g->queue, gauss_bufs[i], gauss_bufs[i + 1], g->gaussian, num_events, wait_list, &e->stage[STAGE_GAUSS]);
+        else
+            status = conv_enqueue(g->conv, g->queue, gauss_bufs[i], gauss_bufs[i + 1], g->gaussian, 1, &prev, &e->stage[STAGE_GAUSS]);
+        if (prev != NULL)
+            clReleaseEvent(prev);
+        if (status == CL_SUCCESS)
+            profile_add(g->prof, "gauss", e->stage[STAGE_GAUSS]);
+    }
+
+    if (status == CL_SUCCESS && g->canny_nms_kernel != NULL) {
+        status = enqueue_canny(g, gray_cl, edge_cl, e);
+        e->last = e->stage[STAGE_THRESHOLD];
+        if (ev == NULL || status != CL_SUCCESS)
+            frame_events_release(e);
+        return status;
+    }
+
+    if (status == CL_SUCCESS)
+        status = conv_enqueue_pair(g->conv, g->queue, g->side_queue, gray_cl, g->edge_x_cl, g->sobel_x, g->edge_y_cl, g->sobel_y,
+                                   1, &e->stage[STAGE_GAUSS], &e->stage[STAGE_SOBEL_X], &e->stage[STAGE_SOBEL_Y]);
+    if (status == CL_SUCCESS) {
+        profile_add(g->prof, "sobel_x", e->stage[STAGE_SOBEL_X]);
+        profile_add(g->prof, "sobel_y", e->stage[STAGE_SOBEL_Y]);
+    }
+    // the average waits on sobel y from the other queue, so it has to be submitted
+    if (status == CL_SUCCESS && g->side_queue != g->queue)
+        status = clFlush(g->side_queue);
+
+    if (status == CL_SUCCESS) {
+        const size_t avg_work_size = g->frame_size_bytes / g->average_vec;
+        status = clSetKernelArg(g->average_kernel, 2, sizeof(cl_mem), &edge_cl);
+        checkError(status, "Failed to set out param in average kernel");
+        status = clEnqueueNDRangeKernel(g->queue, g->average_kernel, 1, NULL, &avg_work_size, tune_local(g->tune, "average"),
+                                        2, &e->stage[STAGE_SOBEL_X], &e->stage[STAGE_AVERAGE]);
+        profile_add(g->prof, "average", e->stage[STAGE_AVERAGE]);
+    }
+
+    if (status == CL_SUCCESS && g->hist_kernel != NULL) {
+        status = enqueue_otsu_threshold(g, edge_cl, 1, &e->stage[STAGE_AVERAGE], &e->stage[STAGE_THRESHOLD]);
+    } else if (status == CL_SUCCESS) {
+        const size_t thresh_work_size = g->frame_size_bytes / g->threshold_vec;
+        status = clSetKernelArg(g->threshold_kernel, 0, sizeof(cl_mem), &edge_cl);
+        checkError(status, "Failed to set img param in threshold kernel");
+        status = clEnqueueNDRangeKernel(g->queue, g->threshold_kernel, 1, NULL, &thresh_work_size, tune_local(g->tune, "threshold"),
+                                        1, &e->stage[STAGE_AVERAGE], &e->stage[STAGE_THRESHOLD]);
+        profile_add(g->prof, "threshold", e->stage[STAGE_THRESHOLD]);
+    }
+
+    e->last = e->stage[STAGE_THRESHOLD];
+    if (ev == NULL || status != CL_SUCCESS)
+        frame_events_release(e);
+    return status;
+}
+
+cl_ulong event_time(cl_event event, cl_profiling_info param)
+{
+    cl_ulong t = 0;
+    int status = clGetEventProfilingInfo(event, param, sizeof(t), &t, NULL);
+    checkError(status, "Failed to get event profiling info");
+    return t;
+}
+
+// device time in ms from the end of from until the later of the two ends of to,
+// so stages that are split over several launches are counted in full
+float stage_ms(cl_event from, cl_event to_a, cl_event to_b)
+{
+    cl_ulong start = event_time(from, CL_PROFILING_COMMAND_END);
+    cl_ulong end = event_time(to_a, CL_PROFILING_COMMAND_END);
+    if (to_b != NULL) {
+        cl_ulong end_b = event_time(to_b, CL_PROFILING_COMMAND_END);
+        end = end_b > end ? end_b : end;
+    }
+    return end > start ? (end - start) / 1.0e6f : 0.0f;
+}
+
+#endif // STAGES_H
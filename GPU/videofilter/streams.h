@@ -0,0 +1,199 @@
+#ifndef STREAMS_H
+#define STREAMS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <CL/cl.h>
+#include "opencv2/opencv.hpp"
+
+#include "helpers.h"
+#include "stages.h"
+#include "pipeline.h"
+
+#define MAX_STREAMS 16
+
+
+// several videos filtered at once. every stream is a pipeline with its own
+// decode and encode thread, slot buffers and command queue. one scheduler
+// thread takes the decoded frames of all streams in the order they come in
+// and submits them, so the gpu has work as long as any stream has a frame ready
+struct stream_set {
+    int num_streams = 0;
+    pipeline *streams[MAX_STREAMS];
+    slot_queue sched_q{};
+};
+
+// output for stream i: out.avi becomes out_<i>.avi
+std::string stream_output_name(const char *output, int i)
+{
+    std::string name(output);
+    const size_t dot = name.find_last_of('.');
+    const size_t slash = name.find_last_of('/');
+    const std::string suffix = "_" + std::to_string(i);
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return name + suffix;
+    return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
+// scheduler thread: owns every opencl call on the slots. the conv scratch and
+// the kernels are shared by the streams, so every frame also waits on the one
+// submitted before it, whichever queue that was on. nothing here blocks, the
+// encode threads wait on slot->ready
+void schedule_frames(stream_set *set)
+{
+    int status;
+    int ended = 0;
+    cl_event prev = NULL;
+
+    while (ended < set->num_streams) {
+        int v = slot_queue_pop(&set->sched_q);
+        if (v < 0) {
+            // all frames of that stream were queued before its end marker
+            slot_queue_push(&set->streams[-1 - v]->filtered_q, -1);
+            ended++;
+            continue;
+        }
+
+        pipeline *p = set->streams[v / MAX_SLOTS];
+        frame_slot *slot = &p->slots[v % MAX_SLOTS];
+        gpu_stages *gpu = p->gpu;
+        const size_t frame_size_bytes = gpu->frame_size_bytes;
+
+        cl_event wait_list[4];
+        cl_uint num_wait = 2;
+        clEnqueueUnmapMemObject(gpu->queue, slot->gray_cl, slot->gray_ptr, 0, NULL, &wait_list[0]);
+        clEnqueueUnmapMemObject(gpu->queue, slot->edge_cl, slot->edge_ptr, 0, NULL, &wait_list[1]);
+        if (slot->bgr_cl != NULL)
+            clEnqueueUnmapMemObject(gpu->queue, slot->bgr_cl, slot->bgr_ptr, 0, NULL, &wait_list[num_wait++]);
+        const cl_uint num_unmap = num_wait;
+        if (prev != NULL)
+            wait_list[num_wait++] = prev;
+
+        frame_events events;
+        status = enqueue_gpu_stages(gpu, slot->bgr_cl, slot->gray_cl, slot->edge_cl, num_wait, wait_list, &events);
+        checkError(status, "Failed to enqueue gpu stages");
+
+        // the queues are in order, so the last map covers the ones before it
+        slot->gray_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, slot->gray_cl, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 1, &events.last, NULL, &status);
+        checkError(status, "Failed to map slot gray buffer");
+        slot->edge_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, slot->edge_cl, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 1, &events.last,
+                                                             slot->bgr_cl == NULL ? &slot->ready : NULL, &status);
+        checkError(status, "Failed to map slot edge buffer");
+        if (slot->bgr_cl != NULL) {
+            slot->bgr_ptr = (unsigned char *)clEnqueueMapBuffer(gpu->queue, slot->bgr_cl, CL_FALSE, CL_MAP_WRITE, 0, 3 * frame_size_bytes, 1, &events.last, &slot->ready, &status);
+            checkError(status, "Failed to map slot bgr buffer");
+        }
+        clFlush(gpu->queue);
+
+        if (prev != NULL)
+            clReleaseEvent(prev);
+        prev = events.last;
+        clRetainEvent(prev);
+        frame_events_release(&events);
+        for (cl_uint i = 0; i < num_unmap; i++)
+            clReleaseEvent(wait_list[i]);
+
+        slot_queue_push(&p->filtered_q, v % MAX_SLOTS);
+    }
+
+    if (prev != NULL)
+        clReleaseEvent(prev);
+}
+
+// filters every input at once, each one written to stream_output_name(output, i).
+// gpu is copied for every stream with a queue of its own. all inputs have to be
+// the same size, headerless raw ones are raw_width x raw_height. returns the
+// number of measured frames over all streams, wall_ms is the time from the
+// first stream done with its warm-up until the last one finished
+int run_streams(const gpu_stages *gpu, cl_context context, cl_device_id device, cl_command_queue_properties queue_props,
+                const char *const *inputs, int num_streams, int raw_width, int raw_height, sink_kind sink, const char *output, cv::Size size,
+                int warmup, int max_frames, int num_slots, double *wall_ms)
+{
+    int status;
+    stream_set *set = new stream_set();
+    frame_source cameras[MAX_STREAMS];
+    frame_sink sinks[MAX_STREAMS];
+    gpu_stages stream_gpu[MAX_STREAMS];
+
+    set->num_streams = num_streams;
+    for (int i = 0; i < num_streams; i++) {
+        if (!source_open(&cameras[i], inputs[i], raw_width, raw_height)) {
+            printf("Could not open the input video: %s\n", inputs[i]);
+            exit(-1);
+        }
+        cv::Size input_size = source_size(&cameras[i]);
+        if (input_size.width != size.width || input_size.height != size.height) {
+            printf("%s is %dx%d, all streams have to be %dx%d\n", inputs[i], input_size.width, input_size.height, size.width, size.height);
+            exit(-1);
+        }
+        const std::string name = stream_output_name(output, i);
+        if (!sink_open(&sinks[i], sink, name.c_str(), size)) {
+            printf("Could not open the output video for write: %s\n", name.c_str());
+            exit(-1);
+        }
+
+        stream_gpu[i] = *gpu;
+        stream_gpu[i].queue = clCreateCommandQueue(context, device, queue_props, &status);
+        checkError(status, "Failed to create stream command queue");
+        stream_gpu[i].side_queue = stream_gpu[i].queue;
+        stream_gpu[i].prof = NULL;
+
+        pipeline *p = new pipeline();
+        p->gpu = &stream_gpu[i];
+        p->camera = &cameras[i];
+        p->output = &sinks[i];
+        p->size = size;
+        p->max_frames = warmup + max_frames;
+        p->warmup = warmup;
+        p->show = false;
+        p->window_name = NULL;
+        p->num_slots = num_slots;
+        p->sched_q = &set->sched_q;
+        p->stream = i;
+        pipeline_alloc_slots(p, context);
+        set->streams[i] = p;
+    }
+
+    std::thread decoders[MAX_STREAMS];
+    std::thread encoders[MAX_STREAMS];
+    for (int i = 0; i < num_streams; i++) {
+        decoders[i] = std::thread(decode_frames, set->streams[i]);
+        encoders[i] = std::thread(encode_frames, set->streams[i]);
+    }
+    std::thread scheduler(schedule_frames, set);
+
+    scheduler.join();
+    int count = 0;
+    auto start = std::chrono::high_resolution_clock::time_point::max();
+    auto end = std::chrono::high_resolution_clock::time_point::min();
+    for (int i = 0; i < num_streams; i++) {
+        decoders[i].join();
+        encoders[i].join();
+
+        pipeline *p = set->streams[i];
+        auto ms = std::chrono::duration_cast<std::chrono::microseconds>(p->end - p->start).count() / 1000.0;
+        printf("stream %d (%s): %d frames in %.1f ms, FPS: %.2lf\n", i, inputs[i], p->count, ms, 1000.0 * p->count / ms);
+        count += p->count;
+        start = p->start < start ? p->start : start;
+        end = p->end > end ? p->end : end;
+    }
+    *wall_ms = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+    printf("%d streams with %d slots each: %d frames in %.1f ms, FPS: %.2lf (over all streams, including load and disp)\n",
+           num_streams, num_slots, count, *wall_ms, 1000.0 * count / *wall_ms);
+
+    for (int i = 0; i < num_streams; i++) {
+        pipeline_release_slots(set->streams[i]);
+        clReleaseCommandQueue(stream_gpu[i].queue);
+        sink_close(&sinks[i]);
+        source_close(&cameras[i]);
+        delete set->streams[i];
+    }
+    delete set;
+
+    return count;
+}
+
+#endif // STREAMS_H
@@ -0,0 +1,61 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "options.h"
+
+
+// totals over the measured frames, the per-stage times are left at 0 for
+// stages that didn't run and with --pipeline or --batch
+struct run_summary {
+    int frames;
+    double wall_ms;     // everything, including load and display
+    double filter_ms;   // only the filtering, what the FPS line is based on
+    double load_ms, gauss_ms, sobel_ms, avg_ms, thresh_ms, fused_ms, disp_ms;
+    double gpu_share;       // fraction of the rows the gpu filtered with --hetero, 1 otherwise
+    double tiles_filtered;  // fraction of the tiles filtered over all frames, 1 without --incremental
+};
+
+static const char *stage_backend(bool cpu)
+{
+    return cpu ? "cpu" : "gpu";
+}
+
+// appends the configuration and results as one json line to opts->summary, so
+// a sweep over several runs can collect them all in one file
+void write_summary(const options *opts, const run_summary *sum)
+{
+    if (opts->summary == NULL)
+        return;
+
+    FILE *fp = strcmp(opts->summary, "-") == 0 ? stdout : fopen(opts->summary, "a");
+    if (fp == NULL) {
+        printf("can't open summary file %s\n", opts->summary);
+        return;
+    }
+
+    const double n = sum->frames > 0 ? sum->frames : 1;
+    const char *mode = opts->num_inputs > 1 ? "streams" : opts->pipeline ? "pipeline" : opts->chained ? "chained" : opts->batch > 1 ? "batch" : "serial";
+    fprintf(fp, "{\"input\": \"%s\", \"streams\": %d, \"mode\": \"%s\", \"batch\": %d, \"fused\": %s, \"conv\": \"%s\", \"blur\": %d, \"layout\": \"%s\", \"sink\": \"%s\", \"incremental\": %d, ",
+            opts->input, opts->num_inputs, mode, opts->batch, opts->fused || opts->cpu_fused ? "true" : "false", conv_impl_name(opts->conv), opts->blur_size, opts->padded ? "padded" : "packed",
+            sink_kind_name(opts->sink), opts->incremental);
+    fprintf(fp, "\"edges\": \"%s\", \"threshold\": \"%s\", ", opts->canny ? "canny" : "sobel", opts->otsu ? "otsu" : "fixed");
+    fprintf(fp, "\"gauss\": \"%s\", \"sobel\": \"%s\", \"avg\": \"%s\", \"thresh\": \"%s\", ",
+            stage_backend(opts->cpu_gauss || opts->cpu_fused), stage_backend(opts->cpu_sobel || opts->cpu_fused),
+            stage_backend(opts->cpu_avg || opts->cpu_fused), stage_backend(opts->cpu_thresh || opts->cpu_fused));
+    fprintf(fp, "\"frames\": %d, \"warmup\": %d, \"wall_ms\": %.3f, \"filter_ms\": %.3f, ",
+            sum->frames, opts->warmup, sum->wall_ms, sum->filter_ms);
+    fprintf(fp, "\"tiles_filtered\": %.4f, \"gpu_share\": %.4f, ", sum->tiles_filtered, sum->gpu_share);
+    fprintf(fp, "\"fps\": %.3f, \"filter_fps\": %.3f, ",
+            sum->wall_ms > 0 ? 1000.0 * sum->frames / sum->wall_ms : 0.0,
+            sum->filter_ms > 0 ? 1000.0 * sum->frames / sum->filter_ms : 0.0);
+    fprintf(fp, "\"mean_ms\": {\"load\": %.3f, \"gauss\": %.3f, \"sobel\": %.3f, \"avg\": %.3f, \"thresh\": %.3f, \"fused\": %.3f, \"disp\": %.3f}}\n",
+            sum->load_ms / n, sum->gauss_ms / n, sum->sobel_ms / n, sum->avg_ms / n, sum->thresh_ms / n, sum->fused_ms / n, sum->disp_ms / n);
+
+    if (fp != stdout)
+        fclose(fp);
+}
+
+#endif // SUMMARY_H
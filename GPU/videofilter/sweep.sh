@@ -0,0 +1,17 @@
+#!/bin/bash
+# runs every cpu/gpu combination of the four stages headless and collects one
+# json line per run in $SUMMARY. extra arguments are passed on to every run, e.g.
+#   ./sweep.sh --input ./bourne.mp4 --frames 100 --warmup 10 --conv separable
+
+SUMMARY=${SUMMARY:-./sweep.jsonl}
+STAGES=(gauss sobel avg thresh)
+
+for mask in $(seq 0 15); do
+    cpu=""
+    for i in 0 1 2 3; do
+        if (( mask & (1 << i) )); then
+            cpu="$cpu${cpu:+,}${STAGES[$i]}"
+        fi
+    done
+    ./videofilter --headless --summary "$SUMMARY" --cpu "${cpu:-none}" "$@" > /dev/null || exit 1
+done
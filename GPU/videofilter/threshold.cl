@@ -1,11 +1,32 @@
-__kernel void threshold(__global uchar16 *img,
+#ifndef VEC
+#define VEC 16
+#endif
+
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+#define UCHARN CAT(uchar, VEC)
+
+// VEC pixels per work-item, the autotuner picks it per device
+__kernel void threshold(__global UCHARN *img,
                         const int thresh,
                         const int maxval)
 {
     // this only implements THRESH_BINARY_INV from OpenCV
     int idx = get_global_id(0);
-    uchar16 th = (uchar16)(thresh);
-    uchar16 mv = (uchar16)(maxval);
-    img[idx] = img[idx] > th ? (uchar16)(0) : mv;
+    UCHARN th = (UCHARN)(thresh);
+    UCHARN mv = (UCHARN)(maxval);
+    img[idx] = img[idx] > th ? (UCHARN)(0) : mv;
     // img[idx] = img[idx] > thresh ? 0 : maxval;
 }
+
+// same as threshold, but the threshold comes from a buffer the otsu kernel
+// wrote on the device, so it can change every frame without the host
+__kernel void threshold_adaptive(__global UCHARN *img,
+                                 __global const int *thresh,
+                                 const int maxval)
+{
+    int idx = get_global_id(0);
+    UCHARN th = (UCHARN)((uchar)thresh[0]);
+    UCHARN mv = (UCHARN)(maxval);
+    img[idx] = img[idx] > th ? (UCHARN)(0) : mv;
+}
@@ -0,0 +1,184 @@
+#ifndef TUNE_STAGES_H
+#define TUNE_STAGES_H
+
+#include <stdio.h>
+#include <CL/cl.h>
+
+#include "helpers.h"
+#include "frame.h"
+#include "convolution.h"
+#include "tune.h"
+
+#define TUNE_NUM_VECS 4
+static const int tune_vecs[TUNE_NUM_VECS] = { 2, 4, 8, 16 };
+
+// builds file with -DVEC=vec and creates kernel name from it, the program is
+// left in *program for the other kernels in the file
+cl_kernel build_vec_kernel(cl_context context, cl_device_id device, const char *file, const char *name, int vec, cl_program *program)
+{
+    int status;
+    char build_options[32];
+    snprintf(build_options, sizeof(build_options), "-DVEC=%d", vec);
+    *program = build_program(context, device, file, build_options);
+    cl_kernel kernel = clCreateKernel(*program, name, &status);
+    checkError(status, "Failed to create vector kernel");
+    return kernel;
+}
+
+// one or two convolutions of in with filter, which runs whichever kernels the
+// impl picks for it
+struct tune_conv_launch {
+    conv_stage *conv;
+    cl_command_queue queue;
+    cl_mem in, out_a, out_b;
+    const conv_filter *filter;
+    bool pair;
+};
+
+static cl_int tune_launch_conv(void *arg)
+{
+    const tune_conv_launch *l = (const tune_conv_launch *)arg;
+    if (l->pair)
+        return conv_enqueue_pair(l->conv, l->queue, l->queue, l->in, l->out_a, l->filter, l->out_b, l->filter, 0, NULL, NULL, NULL);
+    return conv_enqueue(l->conv, l->queue, l->in, l->out_a, l->filter, 0, NULL, NULL);
+}
+
+// the kernels conv runs for a gaussian of blur_size, one at a time. the others
+// in the same launch keep their setting while one is tuned
+static void tune_conv(tune_table *t, cl_device_id device, cl_command_queue queue, conv_stage *conv,
+                      const conv_filter *gaussian, cl_mem in, cl_mem out_a, cl_mem out_b)
+{
+    tune_conv_launch l = { conv, queue, in, out_a, out_b, gaussian, false };
+    const size_t frame_2d[2] = { (size_t)conv->width, (size_t)conv->height };
+
+    switch (conv->impl) {
+    case CONV_SEPARABLE:
+        tune_local_size(t, "row_pass", 0, device, queue, 2, frame_2d, tune_launch_conv, &l);
+        tune_local_size(t, "col_pass", 0, device, queue, 2, frame_2d, tune_launch_conv, &l);
+        l.pair = true;
+        tune_local_size(t, "row_pass2", 0, device, queue, 2, frame_2d, tune_launch_conv, &l);
+        break;
+    case CONV_JIT:
+        tune_local_size(t, "convolve_jit", 0, device, queue, 2, frame_2d, tune_launch_conv, &l);
+        break;
+    case CONV_IMAGE:
+        tune_local_size(t, "convolve_image", 0, device, queue, 2, frame_2d, tune_launch_conv, &l);
+        break;
+    case CONV_INT:
+        tune_local_size(t, "convolve_int", 0, device, queue, 2, conv->int_global_size, tune_launch_conv, &l);
+        break;
+    case CONV_NAIVE:
+        tune_local_size(t, "convolve", 0, device, queue, 1, conv->global_size, tune_launch_conv, &l);
+        break;
+    case CONV_TILED:
+    default:
+        // the local size is the tile the kernel was built for, see --tile
+        break;
+    }
+}
+
+// the vector width of an elementwise kernel over bytes, and its local size for
+// that width. every width is a separate build
+static void tune_elementwise(tune_table *t, cl_context context, cl_device_id device, cl_command_queue queue,
+                             const char *file, const char *name, size_t bytes, cl_mem a, cl_mem b, cl_mem c)
+{
+    double best_ms = -1;
+    int best_vec = 0;
+    size_t best_local[3] = {};
+    const int thresh = 80, maxval = 255;
+
+    for (int v = 0; v < TUNE_NUM_VECS; v++) {
+        const int vec = tune_vecs[v];
+        if (bytes % vec != 0)
+            continue;
+
+        cl_program program;
+        cl_kernel kernel = build_vec_kernel(context, device, file, name, vec, &program);
+        if (c != NULL) {
+            clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+            clSetKernelArg(kernel, 1, sizeof(cl_mem), &b);
+            clSetKernelArg(kernel, 2, sizeof(cl_mem), &c);
+        } else {
+            clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+            clSetKernelArg(kernel, 1, sizeof(int), &thresh);
+            clSetKernelArg(kernel, 2, sizeof(int), &maxval);
+        }
+
+        const double ms = tune_kernel(t, name, vec, device, queue, kernel, 1, bytes / vec, 1);
+        if (ms >= 0 && (best_ms < 0 || ms < best_ms)) {
+            const size_t *local = tune_local(t, name);
+            best_ms = ms;
+            best_vec = vec;
+            for (int d = 0; d < 3; d++)
+                best_local[d] = local != NULL ? local[d] : 0;
+        }
+        clReleaseKernel(kernel);
+        clReleaseProgram(program);
+    }
+
+    if (best_vec > 0) {
+        tune_set(t, name, best_local[0] > 0 ? best_local : NULL, best_vec);
+        printf("%s: %d pixels per work-item\n", name, best_vec);
+    }
+}
+
+// benchmarks the kernels of the configured stages on scratch frames of layout
+// and leaves the winners in t. gray_kernel, hist_kernel and canny_mask_kernel
+// are NULL when their stages aren't used
+void tune_stages(tune_table *t, cl_context context, cl_device_id device, cl_command_queue queue,
+                 conv_stage *conv, int blur_size, const frame_layout *layout, int batch,
+                 cl_kernel gray_kernel, const char *gray_name, cl_kernel hist_kernel, cl_kernel canny_mask_kernel)
+{
+    int status;
+    const size_t bytes = layout->bytes * batch;
+    printf("tuning for %s (%s), %s\n", t->device, t->driver, t->problem);
+
+    cl_mem scratch[3];
+    for (int i = 0; i < 3; i++) {
+        scratch[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &status);
+        checkError(status, "Failed to allocate tuning buffer");
+    }
+
+    conv_filter gaussian;
+    conv_filter_init_gaussian(&gaussian, context, blur_size);
+    conv_prepare(conv, &gaussian);
+    tune_conv(t, device, queue, conv, &gaussian, scratch[0], scratch[1], scratch[2]);
+    conv_filter_release(&gaussian);
+
+    tune_elementwise(t, context, device, queue, "average.cl", "average", bytes, scratch[0], scratch[1], scratch[2]);
+    tune_elementwise(t, context, device, queue, "threshold.cl", "threshold", bytes, scratch[0], NULL, NULL);
+
+    if (gray_kernel != NULL) {
+        cl_mem bgr = clCreateBuffer(context, CL_MEM_READ_ONLY, 3 * (size_t)layout->width * layout->height, NULL, &status);
+        checkError(status, "Failed to allocate tuning bgr buffer");
+        clSetKernelArg(gray_kernel, 0, sizeof(cl_mem), &bgr);
+        clSetKernelArg(gray_kernel, 1, sizeof(cl_mem), &scratch[0]);
+        frame_set_args(gray_kernel, 2, layout, "gray");
+        tune_kernel(t, gray_name, 0, device, queue, gray_kernel, 2, layout->width, layout->height);
+        clReleaseMemObject(bgr);
+    }
+
+    if (hist_kernel != NULL) {
+        cl_mem hist = clCreateBuffer(context, CL_MEM_READ_WRITE, 256 * sizeof(cl_uint), NULL, &status);
+        checkError(status, "Failed to allocate tuning histogram buffer");
+        clSetKernelArg(hist_kernel, 0, sizeof(cl_mem), &scratch[0]);
+        clSetKernelArg(hist_kernel, 1, sizeof(cl_mem), &hist);
+        frame_set_args(hist_kernel, 2, layout, "histogram");
+        tune_kernel(t, "histogram", 0, device, queue, hist_kernel, 2, (layout->width + 15) / 16, layout->height);
+        clReleaseMemObject(hist);
+    }
+
+    if (canny_mask_kernel != NULL) {
+        const int maxval = 255;
+        clSetKernelArg(canny_mask_kernel, 0, sizeof(cl_mem), &scratch[0]);
+        clSetKernelArg(canny_mask_kernel, 1, sizeof(cl_mem), &scratch[1]);
+        clSetKernelArg(canny_mask_kernel, 2, sizeof(int), &maxval);
+        tune_kernel(t, "canny_mask", 0, device, queue, canny_mask_kernel, 1, bytes / 16, 1);
+    }
+
+    for (int i = 0; i < 3; i++)
+        clReleaseMemObject(scratch[i]);
+    tune_save(t);
+}
+
+#endif // TUNE_STAGES_H
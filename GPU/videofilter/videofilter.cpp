@@ -7,18 +7,20 @@
 #include <chrono>
 
 #include "helpers.h"
+#include "frame.h"
+#include "convolution.h"
+#include "options.h"
+#include "stages.h"
+#include "pipeline.h"
+#include "summary.h"
+#include "hetero.h"
+#include "tune_stages.h"
 
 using namespace cv;
 using namespace std;
 
 #define STRING_BUFFER_LEN 1024
 
-#define SHOW 1
-#define GPU_GAUSSIAN 1
-#define GPU_SOBEL 1
-#define GPU_AVERAGE 1
-#define GPU_THRESHOLD 1
-
 
 /* docs and notes
 
@@ -26,8 +28,41 @@ OpenCV Mat object is stored in row-major order, see https://docs.opencv.org/2.4/
 
 */
 
+// maps a frame buffer for the host unless it already is, the stages on the cpu use these
+static void map_frame(cl_command_queue queue, cl_mem buf, unsigned char **ptr, size_t bytes, profiler *prof)
+{
+    int status;
+    if (*ptr != NULL)
+        return;
+    cl_event ev = NULL;
+    *ptr = (unsigned char *)clEnqueueMapBuffer(queue, buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes, 0, NULL, prof->enabled ? &ev : NULL, &status);
+    checkError(status, "Failed to map frame buffer to pointer");
+    if (ev != NULL) {
+        profile_add(prof, "map", ev);
+        clReleaseEvent(ev);
+    }
+}
+
+// hands a frame buffer back to the device before a gpu stage touches it
+static void unmap_frame(cl_command_queue queue, cl_mem buf, unsigned char **ptr, profiler *prof)
+{
+    if (*ptr == NULL)
+        return;
+    cl_event ev = NULL;
+    int status = clEnqueueUnmapMemObject(queue, buf, *ptr, 0, NULL, prof->enabled ? &ev : NULL);
+    checkError(status, "Failed to unmap frame buffer");
+    *ptr = NULL;
+    if (ev != NULL) {
+        profile_add(prof, "unmap", ev);
+        clReleaseEvent(ev);
+    }
+}
+
 int main(int argc, char** argv)
 {
+    options opts;
+    parse_options(argc, argv, &opts);
+
     // defined as variables to be able to send them to kernels
     const int THRESH_VAL = 80;
     const int THRESH_MAXVAL = 255;
@@ -44,10 +79,9 @@ int main(int argc, char** argv)
         CL_PRINTF_BUFFERSIZE_ARM, 0x1000,
         0
     };
-    cl_command_queue queue;
-    cl_program program;
-    cl_kernel convolve_kernel, threshold_kernel, average_kernel;
-    int status, success;
+    cl_command_queue queue, side_queue;
+    cl_kernel threshold_kernel, average_kernel;
+    int status;
 
     // initialize OpenCl 
     clGetPlatformIDs(1, &platform, NULL);
@@ -61,109 +95,160 @@ int main(int argc, char** argv)
     context_properties[1] = (cl_context_properties)platform;
     clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
     context = clCreateContext(context_properties, 1, &device, NULL, NULL, NULL);
-    queue = clCreateCommandQueue(context, device, 0, NULL);
+    // --chained takes the stage timings from the device instead of the host clock
+    cl_command_queue_properties queue_props = opts.chained || opts.hetero || opts.profile != NULL ? CL_QUEUE_PROFILING_ENABLE : 0;
+    if (opts.concurrent == CONCURRENT_OOO) {
+        cl_command_queue_properties supported = 0;
+        clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(supported), &supported, NULL);
+        if (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) {
+            queue_props |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        } else {
+            printf("device has no out-of-order queues, using two queues instead\n");
+            opts.concurrent = CONCURRENT_MULTI;
+        }
+    }
+    queue = clCreateCommandQueue(context, device, queue_props, &status);
+    checkError(status, "Failed to create command queue");
+    side_queue = queue;
+    if (opts.concurrent == CONCURRENT_MULTI) {
+        side_queue = clCreateCommandQueue(context, device, queue_props, &status);
+        checkError(status, "Failed to create side command queue");
+    }
 
-    // build kernels
-    unsigned char **source;
-    
-    // convolve kernel
-    source = read_file("convolve.cl");
-    program = clCreateProgramWithSource(context, 1, (const char **)source, NULL, NULL);
-    if (program == NULL)
-    {
-        printf("Program creation failed\n");
-        return EXIT_FAILURE;
-    }	
-    success = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if(success != CL_SUCCESS) print_clbuild_errors(program,device);
-    convolve_kernel = clCreateKernel(program, "convolve", NULL);
-
-    // threshold kernel
-    source = read_file("threshold.cl");
-    program = clCreateProgramWithSource(context, 1, (const char **)source, NULL, NULL);
-    if (program == NULL)
-    {
-        printf("Program creation failed\n");
-        return EXIT_FAILURE;
-    }	
-    success = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if(success != CL_SUCCESS) print_clbuild_errors(program,device);
-    threshold_kernel = clCreateKernel(program, "threshold", NULL);
-
-
-    // average kernel
-    source = read_file("average.cl");
-    program = clCreateProgramWithSource(context, 1, (const char **)source, NULL, NULL);
-    if (program == NULL)
-    {
-        printf("Program creation failed\n");
-        return EXIT_FAILURE;
-    }	
-    success = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if(success != CL_SUCCESS) print_clbuild_errors(program,device);
-    average_kernel = clCreateKernel(program, "average", NULL);
+    // build kernels, threshold and average once the tuned vector widths are known
+
+    // fused edge kernel, the tile size is baked in because it sizes the local buffers
+    cl_program fused_program = NULL;
+    cl_kernel fused_kernel = NULL;
+    cl_kernel changes_kernel = NULL;
+    if (opts.fused) {
+        char build_options[STRING_BUFFER_LEN];
+        snprintf(build_options, STRING_BUFFER_LEN, "-DTILE_W=%d -DTILE_H=%d%s", opts.tile_w, opts.tile_h,
+                 opts.incremental >= 0 ? " -DINCREMENTAL" : "");
+        fused_program = build_program(context, device, "edge_fused.cl", build_options);
+        fused_kernel = clCreateKernel(fused_program, "edge_fused", NULL);
+        if (opts.incremental >= 0) {
+            changes_kernel = clCreateKernel(fused_program, "tile_changes", &status);
+            checkError(status, "Failed to create tile changes kernel");
+        }
+    }
+
+    // histogram and otsu threshold selection for --otsu
+    cl_program otsu_program = NULL;
+    cl_kernel hist_kernel = NULL, otsu_kernel = NULL;
+    if (opts.otsu) {
+        otsu_program = build_program(context, device, "otsu.cl", NULL);
+        hist_kernel = clCreateKernel(otsu_program, "histogram", &status);
+        checkError(status, "Failed to create histogram kernel");
+        otsu_kernel = clCreateKernel(otsu_program, "otsu", &status);
+        checkError(status, "Failed to create otsu kernel");
+    }
 
+    // canny stages, built with the same tile size as the fused kernel
+    cl_program canny_program = NULL;
+    cl_kernel canny_nms_kernel = NULL, canny_hyst_kernel = NULL, canny_mask_kernel = NULL;
+    if (opts.canny) {
+        char build_options[STRING_BUFFER_LEN];
+        snprintf(build_options, STRING_BUFFER_LEN, "-DTILE_W=%d -DTILE_H=%d", opts.tile_w, opts.tile_h);
+        canny_program = build_program(context, device, "canny.cl", build_options);
+        canny_nms_kernel = clCreateKernel(canny_program, "canny_nms", &status);
+        checkError(status, "Failed to create canny nms kernel");
+        canny_hyst_kernel = clCreateKernel(canny_program, "canny_hysteresis", &status);
+        checkError(status, "Failed to create canny hysteresis kernel");
+        canny_mask_kernel = clCreateKernel(canny_program, "canny_mask", &status);
+        checkError(status, "Failed to create canny mask kernel");
+    }
+
+    // gpu gray conversion, replaces cvtColor on the host
+    cl_program gray_program = NULL;
+    cl_kernel gray_kernel = NULL;
+    const char *gray_name = opts.gray_fused ? "bgr2gray_gauss3" : "bgr2gray";
+    if (opts.gpu_gray) {
+        gray_program = build_program(context, device, "bgr2gray.cl", NULL);
+        gray_kernel = clCreateKernel(gray_program, gray_name, &status);
+        checkError(status, "Failed to create gray kernel");
+    }
 
     // load video
-    VideoCapture camera("./bourne.mp4");
-    if(!camera.isOpened())  // check if we succeeded
+    frame_source camera;
+    if (!source_open(&camera, opts.input, opts.raw_width, opts.raw_height)) {  // check if we succeeded
+        printf("Could not open the input video: %s\n", opts.input);
         return -1;
+    }
 
-    Size size = Size( (int)camera.get(CV_CAP_PROP_FRAME_WIDTH), (int)camera.get(CV_CAP_PROP_FRAME_HEIGHT) );
+    Size size = source_size(&camera);
     cout << "SIZE: " << size << endl;
 
-    // Open the output
-    const string output_filename = "./output.avi";   // Form the new name with container
-    int ex = static_cast<int>(CV_FOURCC('M','J','P','G'));
-    VideoWriter outputVideo;
-    outputVideo.open(output_filename, ex, 25, size, true);
-    if (!outputVideo.isOpened())
-    {
-        cout  << "Could not open the output video for write: " << output_filename << endl;
+    // where the pixels are in the frame buffers, --padded gives the blur its
+    // radius of border and the sobel filters their one pixel
+    frame_layout layout;
+    frame_layout_init(&layout, device, size.width, size.height, opts.padded ? max(1, opts.blur_size / 2) : 0);
+
+    // tuned launch parameters for this device and problem, the kernels without
+    // any keep a NULL local size and their default vector width
+    char problem[STRING_BUFFER_LEN];
+    snprintf(problem, STRING_BUFFER_LEN, "%dx%d pitch %d batch %d", layout.width, layout.height, layout.pitch, opts.batch);
+    tune_table tune;
+    tune_init(&tune, opts.tune_file, device, problem);
+
+    // convolve kernel, needs the frame layout for the launch size
+    conv_stage conv;
+    conv_init(&conv, opts.conv, context, device, &layout, opts.batch, opts.tile_w, opts.tile_h, &tune);
+
+    if (opts.tune)
+        tune_stages(&tune, context, device, queue, &conv, opts.blur_size, &layout, opts.batch,
+                    gray_kernel, gray_name, hist_kernel, canny_mask_kernel);
+
+    // threshold and average kernels, VEC pixels per work-item
+    cl_program threshold_program, average_program;
+    const int threshold_vec = tune_vec(&tune, "threshold", 16);
+    const int average_vec = tune_vec(&tune, "average", 4);
+    threshold_kernel = build_vec_kernel(context, device, "threshold.cl", "threshold", threshold_vec, &threshold_program);
+    cl_kernel adaptive_threshold_kernel = NULL;
+    if (opts.otsu)
+        adaptive_threshold_kernel = clCreateKernel(threshold_program, "threshold_adaptive", NULL);
+    average_kernel = build_vec_kernel(context, device, "average.cl", "average", average_vec, &average_program);
+
+    // Open the output, the streams open their own
+    frame_sink outputVideo;
+    if (opts.num_inputs == 1 && !sink_open(&outputVideo, opts.sink, opts.output, size)) {
+        printf("Could not open the output video for write: %s\n", opts.output);
         return -1;
     }
 
-    int tot_ms = 0;
+    double tot_ms = 0;
     int count = 0;
     const char *window_name = "filter";   // Name shown in the GUI window.
-
-#if SHOW
-    namedWindow(window_name); // Resizable window, might not work on Windows.
-    waitKey(1);
-#endif
+    run_summary sum = {};
+    sum.tiles_filtered = 1;
+    sum.gpu_share = 1;
+    profiler prof;
+    profiler_init(&prof, opts.profile != NULL);
+
+    if (opts.show) {
+        namedWindow(window_name); // Resizable window, might not work on Windows.
+        waitKey(1);
+    }
 
     size_t frame_size_px = size.width * size.height;
-    size_t frame_size_bytes = frame_size_px * sizeof(unsigned char);
-    size_t kern_size = 3;
+    size_t frame_size_bytes = layout.bytes;
 
     // define buffers and allocate them on the gpu
-    cl_mem grayframe_cl, edge_x_cl, edge_y_cl, edge_cl, gaussian_cl, sobel_x_cl, sobel_y_cl;
+    cl_mem grayframe_cl, edge_x_cl, edge_y_cl, edge_cl;
 
     grayframe_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, frame_size_bytes, NULL, &status);
     checkError(status, "Failed to allocate grayframe buffer");
 
-    edge_x_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, frame_size_bytes, NULL, &status);
+    // the gpu stages use edge_x and edge_y as scratch, with --batch they hold the whole batch
+    edge_x_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, opts.batch * frame_size_bytes, NULL, &status);
     checkError(status, "Failed to allocate edge_x buffer");
 
-    edge_y_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, frame_size_bytes, NULL, &status);
+    edge_y_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, opts.batch * frame_size_bytes, NULL, &status);
     checkError(status, "Failed to allocate edge_y buffer");
 
     edge_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, frame_size_bytes, NULL, &status);
     checkError(status, "Failed to allocate edge buffer");
 
-    gaussian_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, kern_size * kern_size * sizeof(float), NULL, &status);
-    checkError(status, "Failed to allocate gaussian kernel buffer");
-
-    sobel_x_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, kern_size * kern_size * sizeof(float), NULL, &status);
-    checkError(status, "Failed to allocal sobel x kernel buffer");
-
-    sobel_y_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, kern_size * kern_size * sizeof(float), NULL, &status);
-    checkError(status, "Failed to allocal sobel y kernel buffer");
-
-
-    // set static convolution kernel args
-    status = clSetKernelArg(convolve_kernel, 2, sizeof(int), &size.width);
-    checkError(status, "Failed to set convolve kernel width arg");
 
     // set threshold kernel args
     status = clSetKernelArg(threshold_kernel, 0, sizeof(cl_mem), &edge_cl);
@@ -181,6 +266,81 @@ int main(int argc, char** argv)
     status = clSetKernelArg(average_kernel, 2, sizeof(cl_mem), &edge_cl);
     checkError(status, "Failed to set out param in average kernel");
 
+    if (gray_kernel != NULL)
+        frame_set_args(gray_kernel, 2, &layout, "gray");
+
+    // set fused kernel args, it reads the unfiltered frame and writes the masked result to edge
+    const size_t fused_local_size[2] = { (size_t)opts.tile_w, (size_t)opts.tile_h };
+    const size_t fused_global_size[2] = {
+        (size.width + fused_local_size[0] - 1) / fused_local_size[0] * fused_local_size[0],
+        (size.height + fused_local_size[1] - 1) / fused_local_size[1] * fused_local_size[1]
+    };
+    if (opts.fused) {
+        status = clSetKernelArg(fused_kernel, 0, sizeof(cl_mem), &grayframe_cl);
+        checkError(status, "Failed to set in param in fused kernel");
+        status = clSetKernelArg(fused_kernel, 1, sizeof(cl_mem), &edge_cl);
+        checkError(status, "Failed to set out param in fused kernel");
+        frame_set_args(fused_kernel, 2, &layout, "fused");
+        status = clSetKernelArg(fused_kernel, 6, sizeof(int), &THRESH_VAL);
+        checkError(status, "Failed to set thresh param in fused kernel");
+        status = clSetKernelArg(fused_kernel, 7, sizeof(int), &THRESH_MAXVAL);
+        checkError(status, "Failed to set maxval param in fused kernel");
+    }
+
+    // the histogram starts out zeroed, after that the otsu kernel clears it
+    cl_mem hist_cl = NULL, thresh_cl = NULL;
+    if (opts.otsu) {
+        cl_uint zero_hist[256] = {};
+        hist_cl = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(zero_hist), zero_hist, &status);
+        checkError(status, "Failed to allocate histogram buffer");
+        thresh_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &status);
+        checkError(status, "Failed to allocate threshold buffer");
+
+        status = clSetKernelArg(hist_kernel, 1, sizeof(cl_mem), &hist_cl);
+        checkError(status, "Failed to set hist param in histogram kernel");
+        frame_set_args(hist_kernel, 2, &layout, "histogram");
+        status = clSetKernelArg(otsu_kernel, 0, sizeof(cl_mem), &hist_cl);
+        checkError(status, "Failed to set hist param in otsu kernel");
+        status = clSetKernelArg(otsu_kernel, 1, sizeof(cl_mem), &thresh_cl);
+        checkError(status, "Failed to set thresh param in otsu kernel");
+        status = clSetKernelArg(adaptive_threshold_kernel, 1, sizeof(cl_mem), &thresh_cl);
+        checkError(status, "Failed to set thresh param in adaptive threshold kernel");
+        status = clSetKernelArg(adaptive_threshold_kernel, 2, sizeof(int), &THRESH_MAXVAL);
+        checkError(status, "Failed to set maxval param in adaptive threshold kernel");
+    }
+
+    // the buffers are set per launch, the rest once here
+    if (opts.canny) {
+        frame_set_args(canny_nms_kernel, 2, &layout, "canny nms");
+        status = clSetKernelArg(canny_nms_kernel, 6, sizeof(float), &opts.canny_low);
+        checkError(status, "Failed to set low param in canny nms kernel");
+        status = clSetKernelArg(canny_nms_kernel, 7, sizeof(float), &opts.canny_high);
+        checkError(status, "Failed to set high param in canny nms kernel");
+        frame_set_args(canny_hyst_kernel, 2, &layout, "canny hysteresis");
+        status = clSetKernelArg(canny_mask_kernel, 2, sizeof(int), &THRESH_MAXVAL);
+        checkError(status, "Failed to set maxval param in canny mask kernel");
+    }
+
+    // last filtered copy of every tile and the per-tile change flags for --incremental
+    const int num_tiles = (int)(fused_global_size[0] / fused_local_size[0] * (fused_global_size[1] / fused_local_size[1]));
+    cl_mem changes_ref_cl = NULL, dirty_cl = NULL;
+    unsigned char *dirty = NULL;
+    if (changes_kernel != NULL) {
+        changes_ref_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, frame_size_bytes, NULL, &status);
+        checkError(status, "Failed to allocate tile reference buffer");
+        dirty_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, num_tiles, NULL, &status);
+        checkError(status, "Failed to allocate tile flag buffer");
+        dirty = new unsigned char[num_tiles];
+
+        status = clSetKernelArg(fused_kernel, 8, sizeof(cl_mem), &dirty_cl);
+        checkError(status, "Failed to set dirty param in fused kernel");
+        status = clSetKernelArg(changes_kernel, 1, sizeof(cl_mem), &changes_ref_cl);
+        checkError(status, "Failed to set ref param in tile changes kernel");
+        status = clSetKernelArg(changes_kernel, 2, sizeof(cl_mem), &dirty_cl);
+        checkError(status, "Failed to set dirty param in tile changes kernel");
+        frame_set_args(changes_kernel, 3, &layout, "tile changes");
+    }
+
 
     unsigned char *grayframe_ptr = NULL, *edge_x_ptr = NULL, *edge_y_ptr = NULL, *edge_ptr = NULL;
 
@@ -196,211 +356,510 @@ int main(int argc, char** argv)
     edge_ptr = (unsigned char *)clEnqueueMapBuffer(queue, edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
     checkError(status, "Failed to map edge buffer to pointer");
 
-    Mat grayframe(size, CV_8U, grayframe_ptr);
-    Mat edge_x(size, CV_8U, edge_x_ptr);
-    Mat edge_y(size, CV_8U, edge_y_ptr);
-    Mat edge(size, CV_8U, edge_ptr);
+    Mat grayframe = frame_mat(&layout, grayframe_ptr);
+    Mat edge_x = frame_mat(&layout, edge_x_ptr);
+    Mat edge_y = frame_mat(&layout, edge_y_ptr);
+    Mat edge = frame_mat(&layout, edge_ptr);
 
-    // set gaussian convolution kernel
-    float gaussian_kern[] = { 1.0/16, 2.0/16, 1.0/16, 2.0/16, 4.0/16, 2.0/16, 1.0/16, 2.0/16, 1.0/16 };
-    status = clEnqueueWriteBuffer(queue, gaussian_cl, CL_TRUE, 0, kern_size * kern_size * sizeof(float), gaussian_kern, 0, NULL, NULL);
-    checkError(status, "Failed to write gaussian kernel to buffer");
+    // set gaussian convolution kernel, 1-2-1 x 1-2-1 / 16 for the default 3x3
+    conv_filter gaussian;
+    conv_filter_init_gaussian(&gaussian, context, opts.blur_size);
 
     // set sobel x convolution kernel
+    conv_filter sobel_x;
     float sobel_x_kern[] = {-3.0, 0.0, 3.0, -10.0, 0.0, 10.0, -3.0, 0.0, 3.0};
-    status = clEnqueueWriteBuffer(queue, sobel_x_cl, CL_TRUE, 0, kern_size * kern_size * sizeof(float), sobel_x_kern, 0, NULL, NULL);
-    checkError(status, "Failed to write sobel x kernel to buffer");
+    conv_filter_init(&sobel_x, context, sobel_x_kern, 3);
 
     // set sobel y convolution kernel
+    conv_filter sobel_y;
     float sobel_y_kern[] = {-3.0, -10.0, -3.0, 0.0, 0.0, 0.0, 3.0, 10.0, 3.0};
-    status = clEnqueueWriteBuffer(queue, sobel_y_cl, CL_TRUE, 0, kern_size * kern_size * sizeof(float), sobel_y_kern, 0, NULL, NULL);
-    checkError(status, "Failed to write sobel y kernel to buffer");
-
-
-    int max_frames = 299;
-    while (true) {
-        if (++count > max_frames) break;
-
-        auto load_start = chrono::high_resolution_clock::now();
-        Mat cameraFrame;
-        camera >> cameraFrame;
-        cvtColor(cameraFrame, grayframe, CV_BGR2GRAY);
-        auto load_end = chrono::high_resolution_clock::now();
-        auto load_dur = chrono::duration_cast<chrono::microseconds>(load_end - load_start).count() / 1000.0f;
-
-        status = clEnqueueUnmapMemObject(queue, grayframe_cl, grayframe_ptr, 0, NULL, NULL);
-        checkError(status, "Failed to unmap grayframe ptr");
-        grayframe_ptr = NULL;
-
-        /* ------------- START OF FILTERING --------------- */
-        auto start = chrono::high_resolution_clock::now();
-
-        auto gauss_start = chrono::high_resolution_clock::now();
-#if GPU_GAUSSIAN
-        status = clSetKernelArg(convolve_kernel, 0, sizeof(cl_mem), &grayframe_cl);
-        checkError(status, "Failed to set convolve kernel input img arg");
-        status = clSetKernelArg(convolve_kernel, 1, sizeof(cl_mem), &grayframe_cl);
-        checkError(status, "Failed to set convolve kernel output img arg");
-        status = clSetKernelArg(convolve_kernel, 3, sizeof(cl_mem), &gaussian_cl);
-        checkError(status, "Failed to set convolve kernel gaussian arg");
-
-        // we're supposed to do the gaussian filter three times
-        for (int i = 0; i < 3; i++) {
-            cl_event gauss_event;
-            status = clEnqueueNDRangeKernel(queue, convolve_kernel, 1, NULL, &frame_size_bytes, NULL, 0, NULL, &gauss_event);
-            checkError(status, "Failed to launch gaussian kernel");
-
-            status = clWaitForEvents(1, &gauss_event);
-            checkError(status, "Failed to wait for gaussian event");
-        }
-
-#else
-        if (grayframe_ptr == NULL)
-            grayframe_ptr = (unsigned char *)clEnqueueMapBuffer(queue, grayframe_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
-
-        GaussianBlur(grayframe, grayframe, Size(3, 3), 0, 0);
-        GaussianBlur(grayframe, grayframe, Size(3, 3), 0, 0);
-        GaussianBlur(grayframe, grayframe, Size(3, 3), 0, 0);
-#endif  // GPU_GAUSSIAN
-        auto gauss_end = chrono::high_resolution_clock::now();
-        auto gauss_dur = chrono::duration_cast<chrono::microseconds>(gauss_end - gauss_start).count() / 1000.0f;
-
-
-        auto sobel_start = chrono::high_resolution_clock::now();
-#if GPU_SOBEL
-        status = clSetKernelArg(convolve_kernel, 0, sizeof(cl_mem), &grayframe_cl);
-        checkError(status, "Failed to set convolve kernel input img arg");
-
-        // sobel x
-        status = clSetKernelArg(convolve_kernel, 1, sizeof(cl_mem), &edge_x_cl);
-        checkError(status, "Failed to set convolve kernel sobel x output img arg");
-        status = clSetKernelArg(convolve_kernel, 3, sizeof(cl_mem), &sobel_x_cl);
-        checkError(status, "Failed to set convolve kernel sobel x kernel buffer arg");
-
-        cl_event sobel_x_event;
-        status = clEnqueueNDRangeKernel(queue, convolve_kernel, 1, NULL, &frame_size_bytes, NULL, 0, NULL, &sobel_x_event);
-        checkError(status, "Failed to launch sobel x kernel");
-
-        status = clWaitForEvents(1, &sobel_x_event);
-        checkError(status, "Failed to wait for sobel x event");
-
-        // sobel y
-        status = clSetKernelArg(convolve_kernel, 1, sizeof(cl_mem), &edge_y_cl);
-        checkError(status, "Failed to set convolve kernel sobel y output img arg");
-        status = clSetKernelArg(convolve_kernel, 3, sizeof(cl_mem), &sobel_y_cl);
-        checkError(status, "Failed to set convolve kernel sobel y kernel buffer arg");
-
-        cl_event sobel_y_event;
-        status = clEnqueueNDRangeKernel(queue, convolve_kernel, 1, NULL, &frame_size_bytes, NULL, 0, NULL, &sobel_y_event);
-        checkError(status, "Failed to launch sobel y kernel");
-
-        status = clWaitForEvents(1, &sobel_y_event);
-        checkError(status, "Failed to wait for sobel y event");
-#else
-        // remap these buffers to use on cpu
-        if (edge_x_ptr == NULL)
-            edge_x_ptr = (unsigned char *)clEnqueueMapBuffer(queue, edge_x_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
-
-        if (edge_y_ptr == NULL)
-            edge_y_ptr = (unsigned char *)clEnqueueMapBuffer(queue, edge_y_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
-
-        Scharr(grayframe, edge_x, CV_8U, 0, 1, 1, 0, BORDER_DEFAULT);
-        Scharr(grayframe, edge_y, CV_8U, 1, 0, 1, 0, BORDER_DEFAULT);
-#endif  // GPU_SOBEL
-        auto sobel_end = chrono::high_resolution_clock::now();
-        auto sobel_dur = chrono::duration_cast<chrono::microseconds>(sobel_end - sobel_start).count() / 1000.0f;
-
-
-        auto avg_start = chrono::high_resolution_clock::now();
-#if GPU_AVERAGE
+    conv_filter_init(&sobel_y, context, sobel_y_kern, 3);
+
+    conv_prepare(&conv, &gaussian);
+    conv_prepare(&conv, &sobel_x);
+    conv_prepare(&conv, &sobel_y);
+
+    printf("separable filters: gaussian %s, sobel x %s, sobel y %s\n",
+           gaussian.separable ? "yes" : "no", sobel_x.separable ? "yes" : "no", sobel_y.separable ? "yes" : "no");
+
+
+    // the whole gpu chain, for the modes that submit a frame at a time
+    gpu_stages gpu;
+    gpu.queue = queue;
+    gpu.side_queue = side_queue;
+    gpu.frame_size_bytes = frame_size_bytes * opts.batch;
+    gpu.gray_kernel = gray_kernel;
+    gpu.gray_fused = opts.gray_fused;
+    gpu.gray_global_size[0] = size.width;
+    gpu.gray_global_size[1] = size.height;
+    gpu.gray_name = gray_name;
+    gpu.fused = opts.fused;
+    gpu.fused_kernel = fused_kernel;
+    gpu.fused_global_size[0] = fused_global_size[0];
+    gpu.fused_global_size[1] = fused_global_size[1];
+    gpu.fused_local_size[0] = fused_local_size[0];
+    gpu.fused_local_size[1] = fused_local_size[1];
+    gpu.changes_kernel = changes_kernel;
+    gpu.changes_ref_cl = changes_ref_cl;
+    gpu.dirty_cl = dirty_cl;
+    gpu.changes_min_sad = opts.incremental * opts.tile_w * opts.tile_h;
+    gpu.changes_primed = false;
+    gpu.dirty = dirty;
+    gpu.conv = &conv;
+    gpu.gaussian = &gaussian;
+    gpu.sobel_x = &sobel_x;
+    gpu.sobel_y = &sobel_y;
+    gpu.average_kernel = average_kernel;
+    gpu.threshold_kernel = threshold_kernel;
+    gpu.average_vec = average_vec;
+    gpu.threshold_vec = threshold_vec;
+    gpu.edge_x_cl = edge_x_cl;
+    gpu.edge_y_cl = edge_y_cl;
+    gpu.hist_kernel = hist_kernel;
+    gpu.hist_global_size[0] = (layout.width + 15) / 16;
+    gpu.hist_global_size[1] = layout.height;
+    gpu.otsu_kernel = otsu_kernel;
+    gpu.adaptive_threshold_kernel = adaptive_threshold_kernel;
+    gpu.hist_cl = hist_cl;
+    gpu.thresh_cl = thresh_cl;
+    gpu.canny_nms_kernel = canny_nms_kernel;
+    gpu.canny_hyst_kernel = canny_hyst_kernel;
+    gpu.canny_mask_kernel = canny_mask_kernel;
+    gpu.canny_passes = opts.canny_passes;
+    gpu.canny_global_size[0] = fused_global_size[0];
+    gpu.canny_global_size[1] = fused_global_size[1];
+    gpu.canny_local_size[0] = fused_local_size[0];
+    gpu.canny_local_size[1] = fused_local_size[1];
+    gpu.tune = &tune;
+    gpu.prof = &prof;
+
+    if (opts.pipeline || opts.chained || opts.batch > 1) {
+        // edge_x and edge_y are only used as gpu scratch buffers from here on
         clEnqueueUnmapMemObject(queue, edge_x_cl, edge_x_ptr, 0, NULL, NULL);
         clEnqueueUnmapMemObject(queue, edge_y_cl, edge_y_ptr, 0, NULL, NULL);
-        clEnqueueUnmapMemObject(queue, edge_cl, edge_ptr, 0, NULL, NULL);
-        edge_x_ptr = NULL; edge_y_ptr = NULL; edge_ptr = NULL;
-
-        cl_event avg_event;
-        const size_t avg_work_size = frame_size_px / 4;
-        status = clEnqueueNDRangeKernel(queue, average_kernel, 1, NULL, &avg_work_size, NULL, 0, NULL, &avg_event);
-        checkError(status, "Failed to launch average kernel");
-
-        status = clWaitForEvents(1, &avg_event);
-        checkError(status, "Failed to wait for average event");
-
-#else
-        addWeighted( edge_x, 0.5, edge_y, 0.5, 0, edge);  // average between edge_x and edge_y, stored in edge
-#endif  // GPU_AVERAGE
-        auto avg_end = chrono::high_resolution_clock::now();
-        auto avg_dur = chrono::duration_cast<chrono::microseconds>(avg_end - avg_start).count() / 1000.0f;
-
-
-        auto thresh_start = chrono::high_resolution_clock::now();
-#if GPU_THRESHOLD
-        // launch threshold kernel
-        clEnqueueUnmapMemObject(queue, edge_cl, edge_ptr, 0, NULL, NULL);
-        edge_ptr = NULL;
-
-        cl_event threshold_event;
-        const size_t thresh_work_size = frame_size_px / 16;
-        status = clEnqueueNDRangeKernel(queue, threshold_kernel, 1, NULL, &thresh_work_size, NULL, 0, NULL, &threshold_event);
-        checkError(status, "Failed to launch threshold kernel");
-
-        status = clWaitForEvents(1, &threshold_event);
-        checkError(status, "Failed to wait for threshold event");
-#else
-        if (edge_ptr == NULL)
-            edge_ptr = (unsigned char *)clEnqueueMapBuffer(queue, edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
-
-        threshold(edge, edge, THRESH_VAL, THRESH_MAXVAL, THRESH_BINARY_INV);  // threshold over 80, all data either 0 or 255
-#endif  // GPU_THRESHOLD
-        auto thresh_end = chrono::high_resolution_clock::now();
-        auto thresh_dur = chrono::duration_cast<chrono::microseconds>(thresh_end - thresh_start).count() / 1000.0f;
-
-        auto end = chrono::high_resolution_clock::now();
-        /* ------------- END OF FILTERING --------------- */
-
-
-        if (edge_ptr == NULL)
-            edge_ptr = (unsigned char *)clEnqueueMapBuffer(queue, edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
-        if (grayframe_ptr == NULL) {
-            grayframe_ptr = (unsigned char *)clEnqueueMapBuffer(queue, grayframe_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 0, NULL, NULL, &status);
-            checkError(status, "Failed to map grayframe buffer to pointer before displaying");
-        }
-
-        auto disp_start = chrono::high_resolution_clock::now();
-        Mat displayframe(size, CV_8U, grayframe_ptr);
-        bitwise_and(displayframe, edge, displayframe);  // this does masking
-        outputVideo << displayframe;
-        auto disp_end = chrono::high_resolution_clock::now();
-        auto disp_dur = chrono::duration_cast<chrono::microseconds>(disp_end - disp_start).count() / 1000.0f;
-
-#if SHOW
-        imshow(window_name, displayframe);
-        waitKey(1);
-#endif
-        
-        auto diff = chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0f;
-        printf("load: %.3f ms  gauss: %.3f ms  sobel: %.3f ms  avg: %.3f ms  thresh: %.3f ms  disp: %.3f ms  full (no disp and load): %.3f ms\n", load_dur, gauss_dur, sobel_dur, avg_dur, thresh_dur, disp_dur, diff);
+        edge_x_ptr = NULL;
+        edge_y_ptr = NULL;
+        // the frames only wait on their own events, which may be out of order with these
+        clFinish(queue);
+    }
 
-        tot_ms += diff;
+    // packed bgr frames for the gpu gray conversion, the decoder writes straight into it
+    cl_mem bgrframe_cl = NULL;
+    unsigned char *bgrframe_ptr = NULL;
+    if (opts.gpu_gray && !opts.pipeline) {
+        bgrframe_cl = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_ONLY, 3 * frame_size_px, NULL, &status);
+        checkError(status, "Failed to allocate bgr frame buffer");
+        bgrframe_ptr = (unsigned char *)clEnqueueMapBuffer(queue, bgrframe_cl, CL_TRUE, CL_MAP_WRITE, 0, 3 * frame_size_px, 0, NULL, NULL, &status);
+        checkError(status, "Failed to map bgr frame buffer to pointer");
     }
 
-    outputVideo.release();
-    camera.release();
-    printf("FPS (#frames = %d): %.2lf .\n", count, (1000.0f * max_frames)/tot_ms);
+    if (opts.num_inputs > 1) {
+        count = run_streams(&gpu, context, device, queue_props, opts.inputs, opts.num_inputs, opts.raw_width, opts.raw_height, opts.sink, opts.output, size,
+                            opts.warmup, opts.frames, opts.slots, &sum.wall_ms);
+    } else if (opts.pipeline) {
+        count = run_pipelined(&gpu, context, &camera, &outputVideo, size, opts.warmup, opts.frames, opts.slots, opts.show, window_name, &sum.wall_ms);
+    } else if (opts.batch > 1) {
+        count = run_batched(&gpu, context, &camera, &outputVideo, size, opts.warmup, opts.frames, opts.batch, opts.show, window_name, &sum.wall_ms, &sum.filter_ms);
+    } else {
+        long tiles_filtered = 0;
+        cpu_edge_pool cpu_pool;
+        if (opts.cpu_fused || opts.hetero) {
+            cpu_edge_init(&cpu_pool, opts.cpu_threads, size.width, size.height, THRESH_VAL, THRESH_MAXVAL);
+            printf("cpu fused pipeline on %d threads\n", cpu_pool.num_threads);
+        }
+        hetero_split split;
+        long gpu_rows_total = 0;
+        if (opts.hetero)
+            hetero_init(&split, size.width, size.height, opts.tile_h);
+        auto wall_start = chrono::high_resolution_clock::now();
+        for (int frame = 0; frame < opts.warmup + opts.frames; frame++) {
+            // the warm-up frames go through everything but aren't counted, the clock restarts after them
+            const bool measured = frame >= opts.warmup;
+            if (frame == opts.warmup)
+                wall_start = chrono::high_resolution_clock::now();
+
+            auto load_start = chrono::high_resolution_clock::now();
+            // with the gpu conversion this decodes into the mapped bgr buffer, raw inputs are copied straight in
+            if (!source_read(&camera, grayframe_ptr + layout.origin, layout.pitch, opts.gpu_gray ? bgrframe_ptr : NULL)) {
+                printf("input ran out after %d frames\n", frame);
+                break;
+            }
+            auto load_end = chrono::high_resolution_clock::now();
+            auto load_dur = chrono::duration_cast<chrono::microseconds>(load_end - load_start).count() / 1000.0f;
+
+            // the cpu share of a --hetero frame is copied out while the host still owns the frame,
+            // it counts as filtering time
+            float hetero_copy_dur = 0;
+            if (opts.hetero) {
+                hetero_stage_input(&split, grayframe_ptr);
+                hetero_copy_dur = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - load_end).count() / 1000.0f;
+            }
+
+            cl_event unmap_events[3];
+            cl_uint num_unmap_events = 1;
+            status = clEnqueueUnmapMemObject(queue, grayframe_cl, grayframe_ptr, 0, NULL, &unmap_events[0]);
+            checkError(status, "Failed to unmap grayframe ptr");
+            grayframe_ptr = NULL;
+
+            /* ------------- START OF FILTERING --------------- */
+            auto start = chrono::high_resolution_clock::now();
+
+            float gauss_dur = 0, sobel_dur = 0, avg_dur = 0, thresh_dur = 0, fused_dur = 0;
+            if (opts.chained) {
+                // edge is written by the last stage, so it has to be unmapped first as well
+                if (edge_ptr != NULL) {
+                    clEnqueueUnmapMemObject(queue, edge_cl, edge_ptr, 0, NULL, &unmap_events[num_unmap_events++]);
+                    edge_ptr = NULL;
+                }
+                if (bgrframe_ptr != NULL) {
+                    clEnqueueUnmapMemObject(queue, bgrframe_cl, bgrframe_ptr, 0, NULL, &unmap_events[num_unmap_events++]);
+                    bgrframe_ptr = NULL;
+                }
+
+                // the whole frame goes in without waiting, the only sync point is the map of edge
+                frame_events events;
+                status = enqueue_gpu_stages(&gpu, bgrframe_cl, grayframe_cl, edge_cl, num_unmap_events, unmap_events, &events);
+                checkError(status, "Failed to enqueue gpu stages");
+
+                cl_event map_wait[3] = { events.last, NULL, NULL };
+                cl_uint num_map_wait = 2;
+                grayframe_ptr = (unsigned char *)clEnqueueMapBuffer(queue, grayframe_cl, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, 1, &events.last, &map_wait[1], &status);
+                checkError(status, "Failed to map grayframe buffer to pointer");
+                if (bgrframe_cl != NULL) {
+                    bgrframe_ptr = (unsigned char *)clEnqueueMapBuffer(queue, bgrframe_cl, CL_FALSE, CL_MAP_WRITE, 0, 3 * frame_size_px, 1, &events.last, &map_wait[num_map_wait++], &status);
+                    checkError(status, "Failed to map bgr frame buffer to pointer");
+                }
+                cl_event edge_map_event = NULL;
+                edge_ptr = (unsigned char *)clEnqueueMapBuffer(queue, edge_cl, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_size_bytes, num_map_wait, map_wait, &edge_map_event, &status);
+                checkError(status, "Failed to map edge buffer to pointer");
+                profile_add(&prof, "map", edge_map_event);
+                if (edge_map_event != NULL)
+                    clReleaseEvent(edge_map_event);
+                for (cl_uint i = 1; i < num_map_wait; i++) {
+                    profile_add(&prof, "map", map_wait[i]);
+                    clReleaseEvent(map_wait[i]);
+                }
+
+                // stage times are measured on the device, from the end of the stage before.
+                // the gpu gray conversion replaces cvtColor, so it counts as load time
+                cl_event filter_start = unmap_events[0];
+                if (events.stage[STAGE_GRAY] != NULL) {
+                    load_dur += stage_ms(unmap_events[0], events.stage[STAGE_GRAY], NULL);
+                    filter_start = events.stage[STAGE_GRAY];
+                }
+                if (opts.fused) {
+                    fused_dur = stage_ms(filter_start, events.stage[STAGE_FUSED], NULL);
+                } else if (opts.canny) {
+                    // gradient and suppression count as sobel, hysteresis as average
+                    gauss_dur = stage_ms(filter_start, events.stage[STAGE_GAUSS], NULL);
+                    sobel_dur = stage_ms(events.stage[STAGE_GAUSS], events.stage[STAGE_NMS], NULL);
+                    avg_dur = stage_ms(events.stage[STAGE_NMS], events.stage[STAGE_HYSTERESIS], NULL);
+                    thresh_dur = stage_ms(events.stage[STAGE_HYSTERESIS], events.stage[STAGE_THRESHOLD], NULL);
+                } else {
+                    gauss_dur = stage_ms(filter_start, events.stage[STAGE_GAUSS], NULL);
+                    cl_event sobel_x_event = events.stage[STAGE_SOBEL_X], sobel_y_event = events.stage[STAGE_SOBEL_Y];
+                    cl_event sobel_last = event_time(sobel_x_event, CL_PROFILING_COMMAND_END) > event_time(sobel_y_event, CL_PROFILING_COMMAND_END) ? sobel_x_event : sobel_y_event;
+                    sobel_dur = stage_ms(events.stage[STAGE_GAUSS], sobel_x_event, sobel_y_event);
+                    avg_dur = stage_ms(sobel_last, events.stage[STAGE_AVERAGE], NULL);
+                    thresh_dur = stage_ms(events.stage[STAGE_AVERAGE], events.stage[STAGE_THRESHOLD], NULL);
+                }
+                frame_events_release(&events);
+            } else if (opts.hetero) {
+                // the top rows go to the fused kernel and the rest to the cpu pool at the same time
+                unmap_frame(queue, edge_cl, &edge_ptr, &prof);
+                const int gpu_rows = split.gpu_rows;
+                const size_t hetero_global_size[2] = {
+                    fused_global_size[0],
+                    (gpu_rows + fused_local_size[1] - 1) / fused_local_size[1] * fused_local_size[1]
+                };
+                cl_event fused_event;
+                status = clEnqueueNDRangeKernel(queue, fused_kernel, 2, NULL, hetero_global_size, fused_local_size, 0, NULL, &fused_event);
+                checkError(status, "Failed to launch fused kernel");
+                clFlush(queue);
+
+                auto cpu_start = chrono::high_resolution_clock::now();
+                if (gpu_rows < size.height)
+                    cpu_edge_rows(&cpu_pool, split.cpu_in.data(), split.cpu_out.data(), gpu_rows, size.height);
+                const double cpu_ms = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - cpu_start).count() / 1000.0;
+
+                // the device time from submission, so it doesn't include the wait for the cpu
+                status = clWaitForEvents(1, &fused_event);
+                checkError(status, "Failed to wait for fused event");
+                const double gpu_ms = (event_time(fused_event, CL_PROFILING_COMMAND_END) - event_time(fused_event, CL_PROFILING_COMMAND_SUBMIT)) / 1.0e6;
+                profile_add(&prof, "fused", fused_event);
+                clReleaseEvent(fused_event);
+
+                map_frame(queue, edge_cl, &edge_ptr, frame_size_bytes, &prof);
+                hetero_merge_output(&split, edge_ptr);
+                printf("split: %d gpu rows in %.3f ms, %d cpu rows in %.3f ms\n", gpu_rows, gpu_ms, size.height - gpu_rows, cpu_ms);
+                if (measured)
+                    gpu_rows_total += gpu_rows;
+                hetero_balance(&split, gpu_ms, cpu_ms);
+                fused_dur = hetero_copy_dur + chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count() / 1000.0f;
+            } else if (opts.cpu_fused) {
+                map_frame(queue, grayframe_cl, &grayframe_ptr, frame_size_bytes, &prof);
+                map_frame(queue, edge_cl, &edge_ptr, frame_size_bytes, &prof);
+                cpu_edge_fused(&cpu_pool, grayframe_ptr, edge_ptr);
+                fused_dur = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count() / 1000.0f;
+            } else if (opts.fused) {
+                // the fused kernel writes to edge, so it can't stay mapped while the kernel runs
+                unmap_frame(queue, edge_cl, &edge_ptr, &prof);
+
+                cl_event changes_event = NULL;
+                if (changes_kernel != NULL) {
+                    status = enqueue_tile_changes(&gpu, grayframe_cl, 0, NULL, &changes_event);
+                    checkError(status, "Failed to launch tile changes kernel");
+                }
+
+                cl_event fused_event;
+                status = clEnqueueNDRangeKernel(queue, fused_kernel, 2, NULL, fused_global_size, fused_local_size,
+                                                changes_event != NULL ? 1 : 0, changes_event != NULL ? &changes_event : NULL, &fused_event);
+                checkError(status, "Failed to launch fused kernel");
+                if (changes_event != NULL)
+                    clReleaseEvent(changes_event);
+
+                status = clWaitForEvents(1, &fused_event);
+                checkError(status, "Failed to wait for fused event");
+                profile_add(&prof, "fused", fused_event);
+                clReleaseEvent(fused_event);
+                fused_dur = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count() / 1000.0f;
+            } else {
+                // every stage maps or unmaps the buffers it uses, so any mix of cpu and gpu stages works
+                auto gauss_start = chrono::high_resolution_clock::now();
+                if (!opts.cpu_gauss) {
+                    // we're supposed to do the gaussian filter three times. filtering in place
+                    // races with neighbouring work-groups, so ping-pong through edge_x and
+                    // edge_y (not used until sobel) and end up back in grayframe
+                    cl_mem gauss_bufs[4] = { grayframe_cl, edge_x_cl, edge_y_cl, grayframe_cl };
+                    unmap_frame(queue, edge_x_cl, &edge_x_ptr, &prof);
+                    unmap_frame(queue, edge_y_cl, &edge_y_ptr, &prof);
+                    for (int i = 0; i < 3; i++) {
+                        cl_event gauss_event;
+                        status = conv_enqueue(&conv, queue, gauss_bufs[i], gauss_bufs[i + 1], &gaussian, 0, NULL, &gauss_event);
+                        checkError(status, "Failed to launch gaussian kernel");
+
+                        status = clWaitForEvents(1, &gauss_event);
+                        checkError(status, "Failed to wait for gaussian event");
+                        profile_add(&prof, "gauss", gauss_event);
+                        clReleaseEvent(gauss_event);
+                    }
+                } else {
+                    map_frame(queue, grayframe_cl, &grayframe_ptr, frame_size_bytes, &prof);
+
+                    GaussianBlur(grayframe, grayframe, Size(opts.blur_size, opts.blur_size), 0, 0);
+                    GaussianBlur(grayframe, grayframe, Size(opts.blur_size, opts.blur_size), 0, 0);
+                    GaussianBlur(grayframe, grayframe, Size(opts.blur_size, opts.blur_size), 0, 0);
+                }
+                auto gauss_end = chrono::high_resolution_clock::now();
+                gauss_dur = chrono::duration_cast<chrono::microseconds>(gauss_end - gauss_start).count() / 1000.0f;
+
+
+                auto sobel_start = chrono::high_resolution_clock::now();
+                if (!opts.cpu_sobel) {
+                    // sobel x and y, the separable kernels share the row pass between them
+                    unmap_frame(queue, grayframe_cl, &grayframe_ptr, &prof);
+                    unmap_frame(queue, edge_x_cl, &edge_x_ptr, &prof);
+                    unmap_frame(queue, edge_y_cl, &edge_y_ptr, &prof);
+                    cl_event sobel_events[2];
+                    status = conv_enqueue_pair(&conv, queue, queue, grayframe_cl, edge_x_cl, &sobel_x, edge_y_cl, &sobel_y, 0, NULL, &sobel_events[0], &sobel_events[1]);
+                    checkError(status, "Failed to launch sobel kernels");
+
+                    status = clWaitForEvents(2, sobel_events);
+                    checkError(status, "Failed to wait for sobel events");
+                    profile_add(&prof, "sobel_x", sobel_events[0]);
+                    profile_add(&prof, "sobel_y", sobel_events[1]);
+                    clReleaseEvent(sobel_events[0]);
+                    clReleaseEvent(sobel_events[1]);
+                } else {
+                    // remap these buffers to use on cpu
+                    map_frame(queue, grayframe_cl, &grayframe_ptr, frame_size_bytes, &prof);
+                    map_frame(queue, edge_x_cl, &edge_x_ptr, frame_size_bytes, &prof);
+                    map_frame(queue, edge_y_cl, &edge_y_ptr, frame_size_bytes, &prof);
+
+                    Scharr(grayframe, edge_x, CV_8U, 0, 1, 1, 0, BORDER_DEFAULT);
+                    Scharr(grayframe, edge_y, CV_8U, 1, 0, 1, 0, BORDER_DEFAULT);
+                }
+                auto sobel_end = chrono::high_resolution_clock::now();
+                sobel_dur = chrono::duration_cast<chrono::microseconds>(sobel_end - sobel_start).count() / 1000.0f;
+
+
+                auto avg_start = chrono::high_resolution_clock::now();
+                if (!opts.cpu_avg) {
+                    unmap_frame(queue, edge_x_cl, &edge_x_ptr, &prof);
+                    unmap_frame(queue, edge_y_cl, &edge_y_ptr, &prof);
+                    unmap_frame(queue, edge_cl, &edge_ptr, &prof);
+
+                    cl_event avg_event;
+                    const size_t avg_work_size = frame_size_bytes / average_vec;
+                    status = clEnqueueNDRangeKernel(queue, average_kernel, 1, NULL, &avg_work_size, tune_local(&tune, "average"), 0, NULL, &avg_event);
+                    checkError(status, "Failed to launch average kernel");
+
+                    status = clWaitForEvents(1, &avg_event);
+                    checkError(status, "Failed to wait for average event");
+                    profile_add(&prof, "average", avg_event);
+                    clReleaseEvent(avg_event);
+                } else {
+                    map_frame(queue, edge_x_cl, &edge_x_ptr, frame_size_bytes, &prof);
+                    map_frame(queue, edge_y_cl, &edge_y_ptr, frame_size_bytes, &prof);
+                    map_frame(queue, edge_cl, &edge_ptr, frame_size_bytes, &prof);
+
+                    addWeighted( edge_x, 0.5, edge_y, 0.5, 0, edge);  // average between edge_x and edge_y, stored in edge
+                }
+                auto avg_end = chrono::high_resolution_clock::now();
+                avg_dur = chrono::duration_cast<chrono::microseconds>(avg_end - avg_start).count() / 1000.0f;
+
+
+                auto thresh_start = chrono::high_resolution_clock::now();
+                if (!opts.cpu_thresh) {
+                    // launch threshold kernel
+                    unmap_frame(queue, edge_cl, &edge_ptr, &prof);
+
+                    cl_event threshold_event;
+                    if (opts.otsu) {
+                        status = enqueue_otsu_threshold(&gpu, edge_cl, 0, NULL, &threshold_event);
+                    } else {
+                        const size_t thresh_work_size = frame_size_bytes / threshold_vec;
+                        status = clEnqueueNDRangeKernel(queue, threshold_kernel, 1, NULL, &thresh_work_size, tune_local(&tune, "threshold"), 0, NULL, &threshold_event);
+                    }
+                    checkError(status, "Failed to launch threshold kernel");
+
+                    status = clWaitForEvents(1, &threshold_event);
+                    checkError(status, "Failed to wait for threshold event");
+                    if (!opts.otsu)
+                        profile_add(&prof, "threshold", threshold_event);
+                    clReleaseEvent(threshold_event);
+                } else {
+                    map_frame(queue, edge_cl, &edge_ptr, frame_size_bytes, &prof);
+
+                    if (opts.otsu)
+                        threshold(edge, edge, 0, THRESH_MAXVAL, THRESH_BINARY_INV | THRESH_OTSU);
+                    else
+                        threshold(edge, edge, THRESH_VAL, THRESH_MAXVAL, THRESH_BINARY_INV);  // threshold over 80, all data either 0 or 255
+                }
+                auto thresh_end = chrono::high_resolution_clock::now();
+                thresh_dur = chrono::duration_cast<chrono::microseconds>(thresh_end - thresh_start).count() / 1000.0f;
+            }  // opts.fused
+
+            auto end = chrono::high_resolution_clock::now();
+            /* ------------- END OF FILTERING --------------- */
+
+
+            map_frame(queue, edge_cl, &edge_ptr, frame_size_bytes, &prof);
+            map_frame(queue, grayframe_cl, &grayframe_ptr, frame_size_bytes, &prof);
+
+            auto disp_start = chrono::high_resolution_clock::now();
+            // the fused kernel has already masked the frame into edge
+            const bool masked = opts.fused || opts.cpu_fused || opts.hetero;
+            Mat displayframe = frame_mat(&layout, masked ? edge_ptr : grayframe_ptr);
+            if (!masked)
+                bitwise_and(displayframe, edge, displayframe);  // this does masking
+            sink_write(&outputVideo, displayframe.data, displayframe.step);
+            auto disp_end = chrono::high_resolution_clock::now();
+            auto disp_dur = chrono::duration_cast<chrono::microseconds>(disp_end - disp_start).count() / 1000.0f;
+
+            if (opts.show) {
+                imshow(window_name, displayframe);
+                waitKey(1);
+            }
+
+            auto diff = chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0f;
+            const int tiles = changes_kernel != NULL ? tiles_refiltered(&gpu) : num_tiles;
+            if (opts.fused || opts.cpu_fused)
+                printf("load: %.3f ms  fused: %.3f ms (%d/%d tiles)  disp: %.3f ms  full (no disp and load): %.3f ms\n", load_dur, fused_dur, tiles, num_tiles, disp_dur, diff);
+            else
+                printf("load: %.3f ms  gauss: %.3f ms  sobel: %.3f ms  avg: %.3f ms  thresh: %.3f ms  disp: %.3f ms  full (no disp and load): %.3f ms\n", load_dur, gauss_dur, sobel_dur, avg_dur, thresh_dur, disp_dur, diff);
+
+            if (measured) {
+                tot_ms += diff;
+                count++;
+                tiles_filtered += tiles;
+                sum.load_ms += load_dur;
+                sum.gauss_ms += gauss_dur;
+                sum.sobel_ms += sobel_dur;
+                sum.avg_ms += avg_dur;
+                sum.thresh_ms += thresh_dur;
+                sum.fused_ms += fused_dur;
+                sum.disp_ms += disp_dur;
+            }
+            for (cl_uint i = 0; i < num_unmap_events; i++) {
+                profile_add(&prof, "unmap", unmap_events[i]);
+                clReleaseEvent(unmap_events[i]);
+            }
+            profile_collect(&prof, measured);
+        }
+        auto wall_end = chrono::high_resolution_clock::now();
+        sum.wall_ms = chrono::duration_cast<chrono::microseconds>(wall_end - wall_start).count() / 1000.0;
+        sum.filter_ms = tot_ms;
+        if (opts.cpu_fused || opts.hetero)
+            cpu_edge_release(&cpu_pool);
+        if (opts.hetero) {
+            sum.gpu_share = count > 0 ? (double)gpu_rows_total / ((double)count * size.height) : 0;
+            printf("hetero: %.1f%% of the rows on the gpu\n", 100.0 * sum.gpu_share);
+        }
+        sum.tiles_filtered = count > 0 ? (double)tiles_filtered / ((double)count * num_tiles) : 1;
+        if (changes_kernel != NULL)
+            printf("incremental: filtered %.1f%% of the tiles\n", 100.0 * sum.tiles_filtered);
+    }  // opts.pipeline
+    sum.frames = count;
+
+    if (opts.num_inputs == 1)
+        sink_close(&outputVideo);
+    source_close(&camera);
+    if (!opts.pipeline && opts.batch == 1)
+        printf("FPS (#frames = %d): %.2lf .\n", count, 1000.0 * count / tot_ms);
+    write_summary(&opts, &sum);
+    profile_write(&prof, opts.profile);
 
     
-    clReleaseKernel(convolve_kernel);
+    conv_release(&conv);
     clReleaseKernel(average_kernel);
     clReleaseKernel(threshold_kernel);
+    clReleaseProgram(average_program);
+    clReleaseProgram(threshold_program);
+    if (changes_kernel != NULL) {
+        clReleaseKernel(changes_kernel);
+        clReleaseMemObject(changes_ref_cl);
+        clReleaseMemObject(dirty_cl);
+        delete[] dirty;
+    }
+    if (fused_kernel != NULL) {
+        clReleaseKernel(fused_kernel);
+        clReleaseProgram(fused_program);
+    }
+    if (otsu_program != NULL) {
+        clReleaseKernel(hist_kernel);
+        clReleaseKernel(otsu_kernel);
+        clReleaseKernel(adaptive_threshold_kernel);
+        clReleaseProgram(otsu_program);
+        clReleaseMemObject(hist_cl);
+        clReleaseMemObject(thresh_cl);
+    }
+    if (canny_program != NULL) {
+        clReleaseKernel(canny_nms_kernel);
+        clReleaseKernel(canny_hyst_kernel);
+        clReleaseKernel(canny_mask_kernel);
+        clReleaseProgram(canny_program);
+    }
+    if (gray_kernel != NULL) {
+        clReleaseKernel(gray_kernel);
+        clReleaseProgram(gray_program);
+    }
+    if (bgrframe_cl != NULL) {
+        if (bgrframe_ptr != NULL)
+            clEnqueueUnmapMemObject(queue, bgrframe_cl, bgrframe_ptr, 0, NULL, NULL);
+        clFinish(queue);
+        clReleaseMemObject(bgrframe_cl);
+    }
+    if (side_queue != queue)
+        clReleaseCommandQueue(side_queue);
     clReleaseCommandQueue(queue);
     clReleaseMemObject(grayframe_cl);
     clReleaseMemObject(edge_x_cl);
     clReleaseMemObject(edge_y_cl);
     clReleaseMemObject(edge_cl);
-    clReleaseMemObject(gaussian_cl);
-    clReleaseMemObject(sobel_x_cl);
-    clReleaseMemObject(sobel_y_cl);
-    clReleaseProgram(program);
+    conv_filter_release(&gaussian);
+    conv_filter_release(&sobel_x);
+    conv_filter_release(&sobel_y);
     clReleaseContext(context);
 
     return EXIT_SUCCESS;